@@ -20,10 +20,25 @@
 
 void cpu_exec(uint64_t n);
 
+// true while an instruction is executed, so the memory accesses
+// made by the debugger can be told apart
+extern bool g_exec_inst;
+
+// whether the last stop of cpu_exec() is caused by a breakpoint
+extern bool g_stop_by_bp;
+
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
 
 #define NEMUTRAP(thispc, code) set_nemu_state(NEMU_END, thispc, code)
 #define INV(thispc) invalid_inst(thispc)
 
+typedef struct {
+  uint64_t load[9], store[9];  // indexed by width in bytes
+  uint64_t mmio_read, mmio_write;
+  uint64_t branch[2];          // not taken, taken
+} InstStat;
+
+extern InstStat g_inststat;
+
 #endif
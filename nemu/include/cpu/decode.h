@@ -96,6 +96,24 @@ finish:
   } \
 } while (0)
 
+// --- dynamic instruction statistics ---
+#ifdef CONFIG_INSTSTAT
+typedef struct {
+  const char *name;
+  uint64_t count;
+} InstPatStat;
+
+// Every INSTPAT() site has its own counter. All of them are placed in
+// the same section, so they can be found without registration.
+#define INSTSTAT(name) do { \
+  static InstPatStat __inststat __attribute__((used, section("nemu_inststat"), aligned(16))) = \
+    { str(name), 0 }; \
+  __inststat.count ++; \
+} while (0)
+#else
+#define INSTSTAT(name)
+#endif
+
 #define INSTPAT_START(name) { const void * __instpat_end = &&concat(__instpat_end_, name);
 #define INSTPAT_END(name)   concat(__instpat_end_, name): ; }
 
@@ -35,6 +35,18 @@ static inline void difftest_detach() {}
 static inline void difftest_attach() {}
 #endif
 
+#ifdef CONFIG_DIFFTEST_MEMCHECK
+// one bit per pmem page written since the last memory check
+extern uint64_t difftest_dirty_page[];
+
+static inline void difftest_mark_dirty(paddr_t addr, int len) {
+  uint32_t pg_start = (addr - CONFIG_MBASE) >> 12;
+  uint32_t pg_end = (addr + len - 1 - CONFIG_MBASE) >> 12;
+  difftest_dirty_page[pg_start / 64] |= 1ull << (pg_start % 64);
+  difftest_dirty_page[pg_end / 64] |= 1ull << (pg_end % 64);
+}
+#endif
+
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
@@ -16,11 +16,17 @@
 #ifndef __DEVICE_MAP_H__
 #define __DEVICE_MAP_H__
 
-#include <cpu/difftest.h>
+#include <common.h>
 
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
 
+typedef struct {
+  int id;   // 0 if the device is never accessed
+  uint64_t nr_read, nr_write, bytes;
+  uint64_t callback_ns;
+} IOMapStat;
+
 typedef struct {
   const char *name;
   // we treat ioaddr_t as paddr_t here
@@ -28,6 +34,7 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  IFDEF(CONFIG_DTRACE, IOMapStat stat);
 } IOMap;
 
 static inline bool map_inside(IOMap *map, paddr_t addr) {
@@ -37,10 +44,7 @@ static inline bool map_inside(IOMap *map, paddr_t addr) {
 static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
   int i;
   for (i = 0; i < size; i ++) {
-    if (map_inside(maps + i, addr)) {
-      difftest_skip_ref();
-      return i;
-    }
+    if (map_inside(maps + i, addr)) return i;
   }
   return -1;
 }
@@ -52,5 +56,6 @@ void add_mmio_map(const char *name, paddr_t addr,
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
+void dtrace_access(IOMap *map, paddr_t addr, int len, word_t data, bool is_write, uint64_t callback_ns);
 
 #endif
@@ -17,6 +17,7 @@
 #define __DIFFTEST_DEF_H__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <macro.h>
 #include <generated/autoconf.h>
 
@@ -37,4 +38,26 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 # error Unsupport ISA
 #endif
 
+// Hash of a memory block shared by DUT and REF to compare memory contents
+// without transferring them. It runs four independent multiply-xorshift
+// lanes over 64-bit words so that the loop can be vectorized.
+// `n` should be a multiple of 32.
+static inline uint64_t difftest_hash(const void *buf, size_t n) {
+  const uint64_t *p = (const uint64_t *)buf;
+  uint64_t h[4] = { 0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full,
+                    0x165667b19e3779f9ull, 0x27d4eb2f165667c5ull };
+  size_t i;
+  int j;
+  for (i = 0; i < n / 8; i += 4) {
+    for (j = 0; j < 4; j ++) {
+      h[j] = (h[j] ^ p[i + j]) * 0x9fb21c651e98df25ull;
+    }
+  }
+  uint64_t ret = n;
+  for (j = 0; j < 4; j ++) {
+    ret = (ret ^ h[j] ^ (h[j] >> 29)) * 0xbf58476d1ce4e5b9ull;
+  }
+  return ret;
+}
+
 #endif
@@ -32,6 +32,8 @@ void init_isa();
 extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+word_t *isa_reg_str2ptr(const char *name);
+const char *isa_reg_name(int i);
 
 // exec
 struct Decode;
@@ -31,6 +31,18 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+// watchpoints are re-evaluated only when a pmem block they read is written
+#define WP_BLOCK_SHIFT 6
+extern uint16_t *wp_block;
+extern bool wp_mem_dirty;
+// the number of address watchpoints, which are checked on every data access
+extern int wp_nr_addr;
+void wp_check_addr(paddr_t addr, int len, bool is_write);
+
+// the checkpoint which saved each pmem page last, for reverse execution
+extern uint32_t *replay_page_seq;
+extern uint32_t replay_seq;
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
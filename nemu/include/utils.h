@@ -40,6 +40,16 @@ extern NEMUState nemu_state;
 
 uint64_t get_time();
 
+// ----------- elf -----------
+
+void init_elf(const char *elf_file);
+int elf_nr_func();
+int elf_func_index(vaddr_t addr);
+const char *elf_func_name(int idx);
+vaddr_t elf_func_addr(int idx);
+vaddr_t elf_func_end(int idx);
+bool elf_func_lookup(const char *name, vaddr_t *addr);
+
 // ----------- log -----------
 
 #define ANSI_FG_BLACK   "\33[1;30m"
@@ -67,8 +77,8 @@ uint64_t get_time();
     extern FILE* log_fp; \
     extern bool log_enable(); \
     if (log_enable() && log_fp != NULL) { \
-      fprintf(log_fp, __VA_ARGS__); \
-      fflush(log_fp); \
+      MUXDEF(CONFIG_LOG_ASYNC, extern void log_printf(const char *fmt, ...); log_printf(__VA_ARGS__), \
+        fprintf(log_fp, __VA_ARGS__); fflush(log_fp)); \
     } \
   } while (0) \
 )
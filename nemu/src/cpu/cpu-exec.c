@@ -17,6 +17,9 @@
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
 #include <locale.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <signal.h>
 #include "../src/monitor/sdb/watchpoint.h"
 
 /* The assembly code of instructions executed is only output to the screen
@@ -28,7 +31,8 @@
 
 CPU_state cpu = {};
 uint64_t g_nr_guest_inst = 0;     // 已执行的客户指令计数
-static uint64_t g_timer = 0;      // unit: us 耗时
+uint64_t g_timer = 0;      // unit: us 耗时
+bool g_exec_inst = false;
 static bool g_print_step = false; // 是否打印每条指令的trace
 
 //#ifdef CONFIG_WATCHPOINT
@@ -37,17 +41,51 @@ int update_wp(void);  // 前置声明
 
 
 void device_update();
+void bintrace_write(vaddr_t pc, const void *inst, int ilen);
+void bintrace_flush();
+void pcsample(vaddr_t pc);
+void inststat_report();
+void json_report(bool is_assert);
+void timeline_cpu_exec(bool is_start, uint64_t n);
+uint64_t itrace_update(uint64_t n, bool print_step);
+uint64_t replay_update(uint64_t n);
+extern void (*itrace_hook)(Decode *s);
+extern uint8_t bp_page[];
+bool bp_hit(vaddr_t pc);
 
-static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
-#ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }// 写入trace日志
+#ifdef CONFIG_PCSAMPLE_BY_INST
+extern uint64_t pcsample_countdown;
+#define pcsample_due() (-- pcsample_countdown == 0)
+#elif defined(CONFIG_PCSAMPLE)
+extern volatile sig_atomic_t pcsample_pending;
+#define pcsample_due() (pcsample_pending)
+#endif
+
+// stop before the instruction at `pc' if there is a breakpoint
+static inline bool bp_check(vaddr_t pc) {
+  return in_pmem(pc) && unlikely(bp_page[(pc - CONFIG_MBASE) >> PAGE_SHIFT]) && bp_hit(pc);
+}
+
+#ifdef CONFIG_BREAKPOINT
+bool g_stop_by_bp = false;  // at `bp_stop_pc'
+static vaddr_t bp_stop_pc = 0;
+
+static bool bp_stop(vaddr_t pc) {
+  if (!bp_check(pc)) return false;
+  nemu_state.state = NEMU_STOP;
+  g_stop_by_bp = true;
+  bp_stop_pc = pc;
+  return true;
+}
 #endif
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); } // 需要时打印
+
+static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+  IFDEF(CONFIG_ITRACE, itrace_hook(_this)); // 写入trace日志, 需要时打印
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc)); // 与参考模型比对
 
   #ifdef CONFIG_WATCHPOINT
   // 仅在定义了 CONFIG_WATCHPOINT 时进行监视点检查  这个检查是在指令执行后，所以指令执行后写的状态nemu.stop或nemu.end会被覆盖
-  if ( nemu_state.state == NEMU_RUNNING && update_wp() > 0) 
+  if ( nemu_state.state == NEMU_RUNNING && (update_wp() > 0 || wp_addr_hit(NULL) >= 0))
   {    
     nemu_state.state = NEMU_STOP;  // 有触发则暂停!!
   }
@@ -56,17 +94,11 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 
 }
 
-static void exec_once(Decode *s, vaddr_t pc) {  //s是译码后的指令
-  s->pc = pc;
-  s->snpc = pc;     // 默认顺序下一条pc
-  isa_exec_once(s); // ISA层执行一条指令
-  cpu.pc = s->dnpc;
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE)
+void format_inst(char *buf, int size, vaddr_t pc, uint8_t *inst, int ilen) {
+  char *p = buf;
+  p += snprintf(p, size, FMT_WORD ":", pc);
   int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst;
 #ifdef CONFIG_ISA_x86
   for (i = 0; i < ilen; i ++) {
 #else
@@ -82,36 +114,107 @@ static void exec_once(Decode *s, vaddr_t pc) {  //s是译码后的指令
   p += space_len;
 
   void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst, ilen);
+  disassemble(p, buf + size - p, MUXDEF(CONFIG_ISA_x86, pc + ilen, pc), inst, ilen);
+}
+#endif
+
+#ifdef CONFIG_IQUEUE
+// The recently executed instructions. Only raw instructions are recorded
+// here, and they are disassembled when something goes wrong.
+typedef struct {
+  vaddr_t pc;
+  ISADecodeInfo isa;
+  IFDEF(CONFIG_ISA_x86, int ilen);
+} IQueueEntry;
+
+static IQueueEntry iqueue[CONFIG_IQUEUE_SIZE] __attribute__((aligned(64))) = {};
+// the instruction being executed, which is pushed only after it finishes
+static Decode *iqueue_cur = NULL;
+
+static inline void iqueue_push(Decode *s) {
+  // g_nr_guest_inst is the index of the current instruction
+  IQueueEntry *e = &iqueue[g_nr_guest_inst % CONFIG_IQUEUE_SIZE];
+  e->pc = s->pc;
+  e->isa = s->isa;
+  IFDEF(CONFIG_ISA_x86, e->ilen = s->snpc - s->pc);
+}
+
+static void iqueue_dump() {
+  uint64_t n = (g_nr_guest_inst < CONFIG_IQUEUE_SIZE ? g_nr_guest_inst : CONFIG_IQUEUE_SIZE);
+  uint64_t i;
+  char buf[128];
+  // e.g. a load which accesses an invalid address
+  bool faulted = (g_exec_inst && iqueue_cur != NULL);
+  _Log("Recently executed instructions:\n");
+  for (i = g_nr_guest_inst - n; i < g_nr_guest_inst; i ++) {
+    IQueueEntry *e = &iqueue[i % CONFIG_IQUEUE_SIZE];
+    format_inst(buf, sizeof(buf), e->pc, (uint8_t *)&e->isa.inst,
+        MUXDEF(CONFIG_ISA_x86, e->ilen, sizeof(e->isa.inst)));
+    _Log("%s %s\n", (i == g_nr_guest_inst - 1 && !faulted ? "-->" : "   "), buf);
+  }
+  if (faulted) {
+    Decode *s = iqueue_cur;
+    // snpc is not advanced if the instruction can not be fetched
+    if (s->snpc == s->pc) _Log("--> " FMT_WORD ": (can not be fetched)\n", s->pc);
+    else {
+      format_inst(buf, sizeof(buf), s->pc, (uint8_t *)&s->isa.inst,
+          MUXDEF(CONFIG_ISA_x86, s->snpc - s->pc, sizeof(s->isa.inst)));
+      _Log("--> %s\n", buf);
+    }
+  }
+}
 #endif
+
+static void exec_once(Decode *s, vaddr_t pc) {  //s是译码后的指令
+  s->pc = pc;
+  s->snpc = pc;     // 默认顺序下一条pc
+  IFDEF(CONFIG_IQUEUE, iqueue_cur = s);
+  g_exec_inst = true;
+  isa_exec_once(s); // ISA层执行一条指令
+  g_exec_inst = false;
+  cpu.pc = s->dnpc;
+  IFDEF(CONFIG_IQUEUE, iqueue_push(s));
+  IFDEF(CONFIG_ITRACE_BINARY, bintrace_write(s->pc, &s->isa.inst, s->snpc - s->pc));
 }
 
 static void execute(uint64_t n) 
 {
   Decode s;
-  for (;n > 0; n --) 
+  while (n > 0)
   {
-    exec_once(&s, cpu.pc);
-    g_nr_guest_inst ++;              // 计数
-    trace_and_difftest(&s, cpu.pc); //执行指令后 进行difftest
-    if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    // the batch ends where the trace window opens or closes
+    uint64_t batch = MUXDEF(CONFIG_ITRACE, itrace_update(n, g_print_step), n);
+    // and where a checkpoint is taken
+    IFDEF(CONFIG_REPLAY, batch = replay_update(batch));
+    n -= batch;
+    for (; batch > 0; batch --)
+    {
+      exec_once(&s, cpu.pc);
+      g_nr_guest_inst ++;              // 计数
+      trace_and_difftest(&s, cpu.pc); //执行指令后 进行difftest
+      IFDEF(CONFIG_PCSAMPLE, if (pcsample_due()) pcsample(s.pc));
+      if (nemu_state.state != NEMU_RUNNING) return;
+      IFDEF(CONFIG_DEVICE, device_update());
+      IFDEF(CONFIG_BREAKPOINT, if (bp_stop(cpu.pc)) return);
+    }
   }
 }
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
-#define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_INSTSTAT, inststat_report());
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_ITRACE_BINARY, bintrace_flush());
+  IFDEF(CONFIG_IQUEUE, iqueue_dump());
   isa_reg_display();
   statistic();
+  IFNDEF(CONFIG_TARGET_AM, json_report(true));
 }
 
 /* Simulate how the CPU works. */
@@ -127,10 +230,23 @@ void cpu_exec(uint64_t n)
     default: nemu_state.state = NEMU_RUNNING;
   }
 
+  IFDEF(CONFIG_WATCHPOINT, wp_addr_clear());
+#ifdef CONFIG_BREAKPOINT
+  // A breakpoint at the pc where execution starts or resumes is checked
+  // before the first instruction, except the one which has just stopped
+  // it, so continuing from a breakpoint does not stop again.
+  bool resume = g_stop_by_bp && bp_stop_pc == cpu.pc;
+  g_stop_by_bp = false;
+  if (!resume && bp_stop(cpu.pc)) return;
+#endif
+
   uint64_t timer_start = get_time();
+  IFDEF(CONFIG_TIMELINE, uint64_t nr_inst_start = g_nr_guest_inst);
+  IFDEF(CONFIG_TIMELINE, timeline_cpu_exec(true, 0));
 
   execute(n);
 
+  IFDEF(CONFIG_TIMELINE, timeline_cpu_exec(false, g_nr_guest_inst - nr_inst_start));
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
 
@@ -139,6 +255,7 @@ void cpu_exec(uint64_t n)
     case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break; //避免无限循环执行
 
     case NEMU_END: case NEMU_ABORT:
+      IFDEF(CONFIG_IQUEUE, if (nemu_state.state == NEMU_ABORT) iqueue_dump());
       Log("nemu: %s at pc = " FMT_WORD,
           (nemu_state.state == NEMU_ABORT ? ANSI_FMT("ABORT", ANSI_FG_RED) :
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
@@ -12,15 +12,18 @@
 *
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
-
+#define _GNU_SOURCE
 #include <dlfcn.h>
+#include <pthread.h>
 
 #include <isa.h>
 #include <cpu/cpu.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <utils.h>
 #include <difftest-def.h>
 
+// the main (first) REF
 void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
@@ -28,6 +31,26 @@ void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
 
 #ifdef CONFIG_DIFFTEST //menuconfig 设置
 
+#define MAX_REF 4
+
+// handle of a loaded REF
+typedef struct {
+  char *name;
+  void (*copy_mem)(paddr_t addr, void *buf, size_t n, bool direction);
+  void (*copy_reg)(void *dut, bool direction);
+  void (*exec)(uint64_t n);
+  void (*raise_intr)(uint64_t NO);
+  uint64_t (*mem_hash)(paddr_t addr, size_t n); // optional
+  void (*reg_set)(int idx, uint64_t val); // optional
+  void (*init)(int port);
+  CPU_state r; // state of REF after the last step or sync
+  bool catch_up; // DUT is catching up with it, see difftest_skip_dut()
+  pthread_t thread;
+} DifftestRef;
+
+static DifftestRef refs[MAX_REF] = {};
+static int nr_ref = 0;
+
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
 
@@ -43,6 +66,8 @@ void difftest_skip_ref() {
   // will load that memory, we will encounter false negative. But such
   // situation is infrequent.
   skip_dut_nr_inst = 0;
+  int i;
+  for (i = 0; i < nr_ref; i ++) refs[i].catch_up = false;
 }
 
 // this is used to deal with instruction packing in QEMU.
@@ -51,44 +76,265 @@ void difftest_skip_ref() {
 // The semantic is
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
-void difftest_skip_dut(int nr_ref, int nr_dut) {
+void difftest_skip_dut(int nr_ref_inst, int nr_dut) {
   skip_dut_nr_inst += nr_dut;
 
-  while (nr_ref -- > 0) {
-    ref_difftest_exec(1);
+  // let every REF run them in one batch, which can be pipelined by REF
+  int i;
+  for (i = 0; i < nr_ref; i ++) {
+    DifftestRef *ref = &refs[i];
+    if (nr_ref_inst > 0) {
+      ref->exec(nr_ref_inst);
+      ref->copy_reg(&ref->r, DIFFTEST_TO_DUT);
+    }
+    ref->catch_up = true;
   }
 }
 
-void init_difftest(char *ref_so_file, long img_size, int port) {
-  assert(ref_so_file != NULL);
+// Sync the state of DUT to REF after a skipped instruction. Usually only
+// a few registers are changed by such an instruction (e.g. the destination
+// register of an MMIO load and pc), so only the registers different from
+// the last synced state are injected if REF supports it.
+static void sync_ref(DifftestRef *ref) {
+  if (ref->reg_set == NULL) {
+    ref->copy_reg(&cpu, DIFFTEST_TO_REF);
+  } else {
+    word_t *dut = (word_t *)&cpu;
+    word_t *last = (word_t *)&ref->r;
+    int i;
+    for (i = 0; i < DIFFTEST_REG_SIZE / sizeof(word_t); i ++) {
+      if (dut[i] != last[i]) ref->reg_set(i, dut[i]);
+    }
+  }
+  memcpy(&ref->r, &cpu, DIFFTEST_REG_SIZE);
+}
+
+// ----------- stepping REFs on worker threads -----------
+
+// With more than one REF, each REF is stepped by its own worker thread.
+// The main thread bumps `step_gen` to start a step on all workers, and
+// waits until all of them finish.
+static pthread_mutex_t step_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t step_go = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t step_done = PTHREAD_COND_INITIALIZER;
+static uint64_t step_gen = 0;
+static int nr_step_done = 0;
+static bool step_quit = false;
+
+static void ref_step(DifftestRef *ref) {
+  ref->exec(1);
+  ref->copy_reg(&ref->r, DIFFTEST_TO_DUT);
+}
+
+static void *ref_worker(void *arg) {
+  DifftestRef *ref = arg;
+  uint64_t gen = 0;
+  while (true) {
+    pthread_mutex_lock(&step_lock);
+    while (step_gen == gen && !step_quit) pthread_cond_wait(&step_go, &step_lock);
+    gen = step_gen;
+    bool quit = step_quit;
+    pthread_mutex_unlock(&step_lock);
+    if (quit) break;
+
+    ref_step(ref);
+
+    pthread_mutex_lock(&step_lock);
+    if (++ nr_step_done == nr_ref) pthread_cond_signal(&step_done);
+    pthread_mutex_unlock(&step_lock);
+  }
+  return NULL;
+}
+
+// called at exit, before the REFs are torn down
+static void stop_ref_workers() {
+  pthread_mutex_lock(&step_lock);
+  step_quit = true;
+  pthread_cond_broadcast(&step_go);
+  pthread_mutex_unlock(&step_lock);
+  int i;
+  for (i = 0; i < nr_ref; i ++) pthread_join(refs[i].thread, NULL);
+}
+
+static void step_all_refs() {
+  if (nr_ref == 1) {
+    ref_step(&refs[0]);
+    return;
+  }
+  pthread_mutex_lock(&step_lock);
+  nr_step_done = 0;
+  step_gen ++;
+  pthread_cond_broadcast(&step_go);
+  while (nr_step_done < nr_ref) pthread_cond_wait(&step_done, &step_lock);
+  pthread_mutex_unlock(&step_lock);
+}
+
+#ifdef CONFIG_DIFFTEST_MEMCHECK
+#define NR_PMEM_PAGE (CONFIG_MSIZE / PAGE_SIZE)
+
+uint64_t difftest_dirty_page[(NR_PMEM_PAGE + 63) / 64] = {};
+static uint64_t memcheck_countdown = CONFIG_DIFFTEST_MEMCHECK_INTERVAL;
+static uint8_t ref_page[PAGE_SIZE] PG_ALIGN = {};
+
+static void report_page_diff(DifftestRef *ref, paddr_t page) {
+  uint8_t *dut = guest_to_host(page);
+  ref->copy_mem(page, ref_page, PAGE_SIZE, DIFFTEST_TO_DUT);
+  int i = 0, nr_range = 0;
+  while (i < PAGE_SIZE && nr_range < 8) {
+    if (dut[i] == ref_page[i]) { i ++; continue; }
+    int start = i;
+    while (i < PAGE_SIZE && dut[i] != ref_page[i]) i ++;
+    Log("memory is different from %s at [" FMT_PADDR ", " FMT_PADDR "], first byte: right = 0x%02x, wrong = 0x%02x",
+        ref->name, page + start, page + i - 1, ref_page[start], dut[start]);
+    nr_range ++;
+  }
+}
+
+static uint64_t ref_page_hash(DifftestRef *ref, paddr_t page) {
+  if (ref->mem_hash != NULL) return ref->mem_hash(page, PAGE_SIZE);
+  ref->copy_mem(page, ref_page, PAGE_SIZE, DIFFTEST_TO_DUT);
+  return difftest_hash(ref_page, PAGE_SIZE);
+}
+
+// Compare the hash of every page written since the last check.
+// Only the pages whose hashes mismatch are diffed byte by byte.
+static bool checkmem() {
+  bool ok = true;
+  int w, i;
+  for (w = 0; w < ARRLEN(difftest_dirty_page); w ++) {
+    uint64_t bits = difftest_dirty_page[w];
+    if (bits == 0) continue;
+    difftest_dirty_page[w] = 0;
+    while (bits != 0) {
+      int b = __builtin_ctzll(bits);
+      bits &= bits - 1;
+      paddr_t page = CONFIG_MBASE + ((paddr_t)(w * 64 + b) << PAGE_SHIFT);
+      uint64_t dut_hash = difftest_hash(guest_to_host(page), PAGE_SIZE);
+      for (i = 0; i < nr_ref; i ++) {
+        if (ref_page_hash(&refs[i], page) != dut_hash) {
+          report_page_diff(&refs[i], page);
+          ok = false;
+        }
+      }
+    }
+  }
+  return ok;
+}
+#endif
 
+static void load_ref(char *ref_so_file) {
+  Assert(nr_ref < MAX_REF, "Too many REFs, at most %d", MAX_REF);
+  int i;
+  bool loaded = false;
+  for (i = 0; i < nr_ref; i ++) {
+    if (strcmp(refs[i].name, ref_so_file) == 0) loaded = true;
+  }
+
+  // load the same REF again in a new namespace to get a separate instance
   void *handle;
-  handle = dlopen(ref_so_file, RTLD_LAZY);
-  assert(handle);
+  handle = (loaded ? dlmopen(LM_ID_NEWLM, ref_so_file, RTLD_LAZY) : dlopen(ref_so_file, RTLD_LAZY));
+  Assert(handle, "Can not load REF '%s': %s", ref_so_file, dlerror());
+
+  DifftestRef *ref = &refs[nr_ref];
+  ref->name = ref_so_file;
+
+  ref->copy_mem = dlsym(handle, "difftest_memcpy");
+  assert(ref->copy_mem);
+
+  ref->copy_reg = dlsym(handle, "difftest_regcpy");
+  assert(ref->copy_reg);
 
-  ref_difftest_memcpy = dlsym(handle, "difftest_memcpy");
-  assert(ref_difftest_memcpy);
+  ref->exec = dlsym(handle, "difftest_exec");
+  assert(ref->exec);
 
-  ref_difftest_regcpy = dlsym(handle, "difftest_regcpy");
-  assert(ref_difftest_regcpy);
+  ref->raise_intr = dlsym(handle, "difftest_raise_intr");
+  assert(ref->raise_intr);
+
+  ref->init = dlsym(handle, "difftest_init");
+  assert(ref->init);
+
+  // optional, see checkmem() and sync_ref()
+  ref->mem_hash = dlsym(handle, "difftest_memhash");
+  ref->reg_set = dlsym(handle, "difftest_regset");
+
+  nr_ref ++;
+}
 
-  ref_difftest_exec = dlsym(handle, "difftest_exec");
-  assert(ref_difftest_exec);
+void init_difftest(char *ref_so_file, long img_size, int port) {
+  assert(ref_so_file != NULL);
 
-  ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
-  assert(ref_difftest_raise_intr);
+  // more than one REF can be given, separated by commas
+  char *name;
+  for (name = strtok(ref_so_file, ","); name != NULL; name = strtok(NULL, ",")) {
+    load_ref(name);
+  }
+  assert(nr_ref > 0);
 
-  void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
-  assert(ref_difftest_init);
+  ref_difftest_memcpy = refs[0].copy_mem;
+  ref_difftest_regcpy = refs[0].copy_reg;
+  ref_difftest_exec = refs[0].exec;
+  ref_difftest_raise_intr = refs[0].raise_intr;
 
   Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
-  Log("The result of every instruction will be compared with %s. "
+  Log("The result of every instruction will be compared with %s%s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
-      "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
+      "If it is not necessary, you can turn it off in menuconfig.", refs[0].name,
+      (nr_ref > 1 ? " and other REFs" : ""));
+
+  int i;
+  for (i = 0; i < nr_ref; i ++) {
+    DifftestRef *ref = &refs[i];
+    if (i > 0) Log("Additional REF: %s", ref->name);
+    ref->init(port + i);
+    ref->copy_mem(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+    ref->copy_reg(&cpu, DIFFTEST_TO_REF);
+    memcpy(&ref->r, &cpu, DIFFTEST_REG_SIZE);
+    if (nr_ref > 1) {
+      int ret = pthread_create(&ref->thread, NULL, ref_worker, ref);
+      Assert(ret == 0, "Can not create the thread for REF '%s'", ref->name);
+    }
+  }
+  if (nr_ref > 1) atexit(stop_ref_workers);
+  IFDEF(CONFIG_DIFFTEST_MEMCHECK, memset(difftest_dirty_page, 0, sizeof(difftest_dirty_page)));
+}
+
+static bool same_state(CPU_state *a, CPU_state *b) {
+  return memcmp(a, b, DIFFTEST_REG_SIZE) == 0;
+}
 
-  ref_difftest_init(port);
-  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
-  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+// Let DUT and all REFs vote with their states after the last step,
+// and report who disagrees with the majority.
+static void vote(vaddr_t pc) {
+  CPU_state *state[MAX_REF + 1];
+  const char *name[MAX_REF + 1];
+  int nr_voter = nr_ref + 1;
+  int i, j;
+  state[0] = &cpu;
+  name[0] = "DUT";
+  for (i = 0; i < nr_ref; i ++) {
+    state[i + 1] = &refs[i].r;
+    name[i + 1] = refs[i].name;
+  }
+
+  int nr_agree[MAX_REF + 1] = {};
+  int best = 0;
+  for (i = 0; i < nr_voter; i ++) {
+    for (j = 0; j < nr_voter; j ++) {
+      if (same_state(state[i], state[j])) nr_agree[i] ++;
+    }
+    if (nr_agree[i] > nr_agree[best]) best = i;
+  }
+
+  Log("Vote after executing instruction at pc = " FMT_WORD ":", pc);
+  for (i = 0; i < nr_voter; i ++) {
+    bool with_majority = same_state(state[i], state[best]);
+    Log("  %-40s %s", name[i], (with_majority ?
+          ANSI_FMT("agrees with the majority", ANSI_FG_GREEN) :
+          ANSI_FMT("DISAGREES", ANSI_FG_RED)));
+  }
+  if (nr_agree[best] * 2 <= nr_voter) {
+    Log("There is no majority.");
+  }
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
@@ -99,22 +345,53 @@ static void checkregs(CPU_state *ref, vaddr_t pc) {
   }
 }
 
+static void checkregs_all(vaddr_t pc) {
+  int i;
+  bool ok = true;
+  for (i = 0; i < nr_ref; i ++) {
+    ok &= same_state(&refs[i].r, &cpu);
+  }
+  if (ok) return;
+
+  if (nr_ref > 1) vote(pc);
+  for (i = 0; i < nr_ref; i ++) {
+    if (!same_state(&refs[i].r, &cpu)) {
+      if (nr_ref > 1) Log("Compare with %s:", refs[i].name);
+      checkregs(&refs[i].r, pc);
+      break;
+    }
+  }
+}
+
 //主对比函数
 void difftest_step(vaddr_t pc, vaddr_t npc) {
-  CPU_state ref_r;
+  int i;
   // 情况 A：DUT 需要追赶 REF（skip_dut_nr_inst > 0）
   // 例如 REF 一次执行了多条指令（instruction packing），我们让 DUT 跳过若干次检查，
-  // 直到 DUT 的 pc 追上 REF（ref_r.pc == npc），再恢复比较。
+  // 直到 DUT 的 pc 追上 REF（ref->r.pc == npc），再恢复比较。
+  // 每个 REF 分别追赶，已追上的 REF 恢复逐条执行并比较。
   if (skip_dut_nr_inst > 0) {
-    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);// 从 REF 读寄存器到 ref_r
-    if (ref_r.pc == npc) {  //pc相等时才进行check regs
+    DifftestRef *behind = NULL;
+    for (i = 0; i < nr_ref && nemu_state.state != NEMU_ABORT; i ++) {
+      DifftestRef *ref = &refs[i];
+      if (!ref->catch_up) {
+        ref_step(ref);
+        checkregs(&ref->r, pc);
+        continue;
+      }
+      ref->copy_reg(&ref->r, DIFFTEST_TO_DUT);// 从 REF 读寄存器到 ref->r
+      if (ref->r.pc == npc) {  //pc相等时才进行check regs
+        ref->catch_up = false;
+        checkregs(&ref->r, npc); // 比较并可能触发 abort
+      } else if (behind == NULL) behind = ref;
+    }
+    if (behind == NULL) {
       skip_dut_nr_inst = 0;
-      checkregs(&ref_r, npc); // 比较并可能触发 abort
       return;
     }
     skip_dut_nr_inst --;
     if (skip_dut_nr_inst == 0)
-      panic("can not catch up with ref.pc = " FMT_WORD " at pc = " FMT_WORD, ref_r.pc, pc);
+      panic("can not catch up with %s, ref.pc = " FMT_WORD " at pc = " FMT_WORD, behind->name, behind->r.pc, pc);
     return;
   }
 
@@ -122,16 +399,27 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
   // 有些指令在 REF 上无法逐条对应，直接把 DUT 状态写回 REF，跳过比较。
   if (is_skip_ref) {
     // to skip the checking of an instruction, just copy the reg state to reference design
-    ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);// 把 DUT 的 cpu 状态写入 REF
+    for (i = 0; i < nr_ref; i ++) {
+      sync_ref(&refs[i]); // 把 DUT 的 cpu 状态写入 REF
+    }
     is_skip_ref = false;
     return;
   }
 
   // 正常路径：让 REF 执行一条指令，然后读出 REF 寄存器并比较
-  ref_difftest_exec(1);                             // REF 执行 1 条指令
-  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);     // 将 REF 状态读到 ref_r
+  step_all_refs();
+  checkregs_all(pc);
 
-  checkregs(&ref_r, pc);                            // 交给 isa_difftest_checkregs 比较
+#ifdef CONFIG_DIFFTEST_MEMCHECK
+  if (-- memcheck_countdown == 0) {
+    memcheck_countdown = CONFIG_DIFFTEST_MEMCHECK_INTERVAL;
+    if (nemu_state.state != NEMU_ABORT && !checkmem()) {
+      Log("Memory checksum mismatch detected after executing instruction at pc = " FMT_WORD, pc);
+      nemu_state.state = NEMU_ABORT;
+      nemu_state.halt_pc = pc;
+    }
+  }
+#endif
 }
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
@@ -19,19 +19,37 @@
 #include <memory/paddr.h>
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) {
+    memcpy(guest_to_host(addr), buf, n);
+  } else {
+    memcpy(buf, guest_to_host(addr), n);
+  }
+}
+
+__EXPORT uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  return difftest_hash(guest_to_host(addr), n);
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) {
+    memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+  } else {
+    memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
+  }
+}
+
+// set the `idx`-th register in the layout of difftest_regcpy()
+__EXPORT void difftest_regset(int idx, uint64_t val) {
+  assert(idx >= 0 && idx < DIFFTEST_REG_SIZE / sizeof(word_t));
+  ((word_t *)&cpu)[idx] = val;
 }
 
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  cpu_exec(n);
 }
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
 }
 
 __EXPORT void difftest_init(int port) {
@@ -33,6 +33,17 @@ void init_alarm();
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
+#ifndef CONFIG_TARGET_AM
+// the events are polled by the render thread of VGA if the screen is shown
+#ifdef CONFIG_VGA_SHOW_SCREEN
+bool vga_poll_event(SDL_Event *ev);
+#define poll_event vga_poll_event
+#else
+// no window, and SDL may not be initialized at all
+#define poll_event(ev) (SDL_WasInit(SDL_INIT_VIDEO) != 0 && SDL_PollEvent(ev))
+#endif
+#endif
+
 void device_update() {
   static uint64_t last = 0;
   uint64_t now = get_time();
@@ -45,7 +56,7 @@ void device_update() {
 
 #ifndef CONFIG_TARGET_AM
   SDL_Event event;
-  while (SDL_PollEvent(&event)) {
+  while (poll_event(&event)) {
     switch (event.type) {
       case SDL_QUIT:
         nemu_state.state = NEMU_QUIT;
@@ -69,7 +80,7 @@ void device_update() {
 void sdl_clear_event_queue() {
 #ifndef CONFIG_TARGET_AM
   SDL_Event event;
-  while (SDL_PollEvent(&event));
+  while (poll_event(&event));
 #endif
 }
 
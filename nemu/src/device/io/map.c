@@ -42,8 +42,28 @@ static void check_bound(IOMap *map, paddr_t addr) {
   }
 }
 
-static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
-  if (c != NULL) { c(offset, len, is_write); }
+#ifdef CONFIG_DTRACE
+#include <time.h>
+
+static inline uint64_t now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+#endif
+
+#ifdef CONFIG_DTRACE
+// host time of the callback of the current access, counted by dtrace
+static uint64_t callback_ns = 0;
+#endif
+
+static void invoke_callback(IOMap *map, paddr_t offset, int len, bool is_write) {
+  IFDEF(CONFIG_DTRACE, callback_ns = 0);
+  if (map->callback != NULL) {
+    IFDEF(CONFIG_DTRACE, uint64_t start = now_ns());
+    map->callback(offset, len, is_write);
+    IFDEF(CONFIG_DTRACE, callback_ns = now_ns() - start);
+  }
 }
 
 void init_map() {
@@ -56,8 +76,9 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
-  invoke_callback(map->callback, offset, len, false); // prepare data to read
+  invoke_callback(map, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  IFDEF(CONFIG_DTRACE, dtrace_access(map, addr, len, ret, false, callback_ns));
   return ret;
 }
 
@@ -66,5 +87,6 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
-  invoke_callback(map->callback, offset, len, true);
+  invoke_callback(map, offset, len, true);
+  IFDEF(CONFIG_DTRACE, dtrace_access(map, addr, len, data, true, callback_ns));
 }
@@ -34,18 +34,126 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+/* The screen is divided into tiles. Writes to vmem mark the tiles they
+ * touch, and only the dirty tiles are processed when the guest writes the
+ * sync register, so a game which changes a small part of the screen does
+ * not pay for a full frame. Both the SDL screen and the headless capture
+ * work on the dirty tiles.
+ */
+#if defined(CONFIG_VGA_CAPTURE) || (defined(CONFIG_VGA_SHOW_SCREEN) && !defined(CONFIG_TARGET_AM))
+#define VGA_DIRTY_TILE
+#define TILE 16
+#define NR_TILE_X ((SCREEN_W + TILE - 1) / TILE)
+#define NR_TILE_Y ((SCREEN_H + TILE - 1) / TILE)
+
+typedef uint64_t TileMap[NR_TILE_Y];  // a bit for every tile of a row
+
+static TileMap vmem_dirty = {};   // tiles written since the last sync
+
+static inline void mark_dirty(uint32_t offset) {
+  uint32_t pixel = offset / sizeof(uint32_t);
+  uint32_t x = pixel % SCREEN_W, y = pixel / SCREEN_W;
+  vmem_dirty[y / TILE] |= 1ull << (x / TILE);
+}
+
+static void vmem_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  mark_dirty(offset);
+  mark_dirty(offset + len - 1);
+}
+
+// call f() for every run of tiles in a row of `map', then clear `map'
+static void for_each_run(TileMap map, void (*f)(void *, int, int, int, int), void *arg) {
+  int ty;
+  for (ty = 0; ty < NR_TILE_Y; ty ++) {
+    uint64_t bits = map[ty];
+    while (bits != 0) {
+      int x0 = __builtin_ctzll(bits);
+      int n = __builtin_ctzll(~(bits >> x0));
+      bits &= ~(((1ull << n) - 1) << x0);
+      int x = x0 * TILE, y = ty * TILE;
+      int x1 = (x0 + n) * TILE, y1 = y + TILE;
+      f(arg, x, y, (x1 < SCREEN_W ? x1 : SCREEN_W) - x, (y1 < SCREEN_H ? y1 : SCREEN_H) - y);
+    }
+    map[ty] = 0;
+  }
+}
+#endif
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
+#include <pthread.h>
+
+/* Frames are presented by a render thread, and the CPU never waits for
+ * SDL. On sync, the dirty tiles are copied to the back buffer, which is
+ * then handed to the render thread; if the render thread is still busy
+ * with the other buffer, the back buffer is handed over later as it is,
+ * or merged with the next synced frame. The render thread owns the
+ * window, so it also polls the SDL events and passes them to
+ * device_update() through a queue.
+ */
+#define EVENT_QUEUE_SIZE 256
+
+typedef struct {
+  uint32_t pixel[SCREEN_W * SCREEN_H];
+  TileMap upload;   // tiles to upload to the texture
+} Frame;
+
+static TileMap stale[2] = {};     // tiles of the buffers older than vmem
+static TileMap upload = {};       // tiles changed since the last handover
+static Frame frame[2];
+static int back = 0;              // the buffer written by the CPU thread
+static int ready = -1;            // the buffer handed to the render thread
+static bool pending = false;      // a frame is waiting for the render thread
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;  // a frame is presented
+
+static SDL_Event event_queue[EVENT_QUEUE_SIZE];
+static uint32_t event_head = 0;   // written by the render thread
+static uint32_t event_tail = 0;   // written by the CPU thread
+
+static void copy_rect(void *arg, int x, int y, int w, int h) {
+  Frame *f = arg;
+  int i;
+  for (i = y; i < y + h; i ++) {
+    memcpy(&f->pixel[i * SCREEN_W + x], (uint32_t *)vmem + i * SCREEN_W + x, w * sizeof(uint32_t));
+  }
+}
 
-static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
 
-static void init_screen() {
+static void upload_rect(void *arg, int x, int y, int w, int h) {
+  Frame *f = arg;
+  SDL_Rect r = { .x = x, .y = y, .w = w, .h = h };
+  SDL_UpdateTexture(texture, &r, &f->pixel[y * SCREEN_W + x], SCREEN_W * sizeof(uint32_t));
+}
+
+bool vga_poll_event(SDL_Event *ev) {
+  uint32_t t = event_tail;
+  if (t == __atomic_load_n(&event_head, __ATOMIC_ACQUIRE)) return false;
+  *ev = event_queue[t % EVENT_QUEUE_SIZE];
+  __atomic_store_n(&event_tail, t + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static void push_events() {
+  SDL_Event ev;
+  while (SDL_PollEvent(&ev)) {
+    uint32_t h = event_head;
+    // drop the event if the CPU thread does not consume them
+    if (h - __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE) == EVENT_QUEUE_SIZE) continue;
+    event_queue[h % EVENT_QUEUE_SIZE] = ev;
+    __atomic_store_n(&event_head, h + 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void *render_thread(void *arg) {
   SDL_Window *window = NULL;
+  SDL_Renderer *renderer = NULL;
   char title[128];
   sprintf(title, "%s-NEMU", str(__GUEST_ISA__));
-  SDL_Init(SDL_INIT_VIDEO);
   SDL_CreateWindowAndRenderer(
       SCREEN_W * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
       SCREEN_H * (MUXDEF(CONFIG_VGA_SIZE_400x300, 2, 1)),
@@ -54,13 +162,98 @@ static void init_screen() {
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
       SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
   SDL_RenderPresent(renderer);
+
+  pthread_mutex_lock(&lock);
+  while (true) {
+    if (ready < 0) {
+      // wake up periodically to poll the events
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 10 * 1000000;
+      if (ts.tv_nsec >= 1000000000) { ts.tv_sec ++; ts.tv_nsec -= 1000000000; }
+      pthread_cond_timedwait(&cond, &lock, &ts);
+    }
+    Frame *f = (ready < 0 ? NULL : &frame[ready]);
+    pthread_mutex_unlock(&lock);
+
+    if (f != NULL) {
+      for_each_run(f->upload, upload_rect, f);
+      SDL_RenderClear(renderer);
+      SDL_RenderCopy(renderer, texture, NULL, NULL);
+      SDL_RenderPresent(renderer);
+    }
+    push_events();
+
+    pthread_mutex_lock(&lock);
+    if (f != NULL) {
+      ready = -1;
+      pthread_cond_signal(&done);
+    }
+  }
+  return NULL;
+}
+
+static void init_screen() {
+  SDL_Init(SDL_INIT_VIDEO);
+  pthread_t tid;
+  int ret = pthread_create(&tid, NULL, render_thread, NULL);
+  Assert(ret == 0, "Can not create the render thread");
+  pthread_detach(tid);
+}
+
+// hand the back buffer over to the render thread if it is idle, with `lock' held
+static void handover() {
+  if (ready >= 0) { pending = true; return; }
+  Frame *f = &frame[back];
+  memcpy(f->upload, upload, sizeof(upload));
+  memset(upload, 0, sizeof(upload));
+  ready = back;
+  back ^= 1;
+  pending = false;
+  pthread_cond_signal(&cond);
 }
 
 static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
-  SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, texture, NULL, NULL);
-  SDL_RenderPresent(renderer);
+  int ty;
+  bool changed = false;
+  for (ty = 0; ty < NR_TILE_Y; ty ++) {
+    uint64_t d = vmem_dirty[ty];
+    stale[0][ty] |= d;
+    stale[1][ty] |= d;
+    upload[ty] |= d;
+    changed |= (upload[ty] != 0);
+    vmem_dirty[ty] = 0;
+  }
+  if (!changed) return;
+
+  // the render thread never reads the back buffer
+  Frame *f = &frame[back];
+  for_each_run(stale[back], copy_rect, f);
+
+  pthread_mutex_lock(&lock);
+  handover();
+  pthread_mutex_unlock(&lock);
+}
+
+// the render thread was busy at the last sync, the tiles written since then
+// belong to the next frame and are not copied
+static void retry_screen() {
+  pthread_mutex_lock(&lock);
+  handover();
+  pthread_mutex_unlock(&lock);
+}
+
+// wait until the last frame is presented, but not forever
+static void flush_screen() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec ++;
+  pthread_mutex_lock(&lock);
+  while (pending || ready >= 0) {
+    if (pending) handover();
+    if (pthread_cond_timedwait(&done, &lock, &ts) != 0) break;
+  }
+  pthread_mutex_unlock(&lock);
 }
 #else
 static void init_screen() {}
@@ -71,22 +264,190 @@ static inline void update_screen() {
 #endif
 #endif
 
+#ifdef CONFIG_VGA_CAPTURE
+#include <device/alarm.h>
+#include <limits.h>
+
+/* Headless capture, SDL is not initialized. On sync, the dirty tiles are
+ * converted into the output buffer, and the frame is written unless
+ * nothing has changed since the last written one. A .y4m file is a
+ * YUV4MPEG2 stream with 4:4:4 chroma; otherwise the file name is a pattern
+ * of PPM files with one %d, which is replaced by the index of the sync.
+ * The stream is declared at TIMER_HZ frames per second, but the skipped
+ * frames take no time in it, so the playback time is compressed and does
+ * not match the time of the guest.
+ */
+static bool headless = MUXDEF(CONFIG_VGA_SHOW_SCREEN, false, true);
+static const char *capture_file = CONFIG_VGA_CAPTURE_FILE;
+static FILE *capture_fp = NULL;
+static bool is_y4m = false;
+static uint8_t *capture_buf = NULL;  // Y, U and V planes for Y4M, RGB for PPM
+static uint64_t nr_sync = 0, nr_frame = 0;
+// the PPM pattern is split into prefix, "%0<width>d" and suffix
+static int name_prefix_len = 0, name_width = 0;
+static bool name_zero = false;
+static const char *name_suffix = NULL;
+
+void vga_set_headless(const char *file) {
+  headless = true;
+  if (file != NULL) capture_file = file;
+}
+
+static void convert_rect(void *arg, int x, int y, int w, int h) {
+  const int plane = SCREEN_W * SCREEN_H;
+  int i, j;
+  for (i = y; i < y + h; i ++) {
+    uint32_t *p = (uint32_t *)vmem + i * SCREEN_W;
+    for (j = x; j < x + w; j ++) {
+      int r = (p[j] >> 16) & 0xff, g = (p[j] >> 8) & 0xff, b = p[j] & 0xff;
+      if (is_y4m) {
+        // BT.601, limited range
+        uint8_t *q = capture_buf + i * SCREEN_W + j;
+        q[0]         = ((  66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+        q[plane]     = (( -38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+        q[plane * 2] = (( 112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+      } else {
+        uint8_t *q = capture_buf + (i * SCREEN_W + j) * 3;
+        q[0] = r; q[1] = g; q[2] = b;
+      }
+    }
+  }
+}
+
+static void capture_frame() {
+  nr_sync ++;
+  bool changed = false;
+  int ty;
+  for (ty = 0; ty < NR_TILE_Y; ty ++) changed |= (vmem_dirty[ty] != 0);
+  if (!changed) return;
+  for_each_run(vmem_dirty, convert_rect, NULL);
+
+  if (is_y4m) {
+    fputs("FRAME\n", capture_fp);
+    fwrite(capture_buf, SCREEN_W * SCREEN_H, 3, capture_fp);
+  } else {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), (name_zero ? "%.*s%0*" PRIu64 "%s" : "%.*s%*" PRIu64 "%s"),
+        name_prefix_len, capture_file, name_width, nr_sync - 1, name_suffix);
+    FILE *fp = fopen(name, "wb");
+    if (fp == NULL) {
+      Log("Can not open '%s', the frame is not captured", name);
+      return;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+    fwrite(capture_buf, SCREEN_W * SCREEN_H, 3, fp);
+    fclose(fp);
+  }
+  nr_frame ++;
+}
+
+static void capture_close() {
+  if (capture_fp != NULL) fclose(capture_fp);
+  Log("%" PRIu64 " frames of %" PRIu64 " syncs are captured to %s", nr_frame, nr_sync, capture_file);
+}
+
+// accept a pattern with exactly one %d or %<width>d, and no other conversion
+static bool parse_name_pattern(const char *s) {
+  const char *p = strchr(s, '%');
+  if (p == NULL) return false;
+  const char *q = p + 1;
+  name_zero = (*q == '0');
+  int width = 0;
+  for (; *q >= '0' && *q <= '9'; q ++) {
+    width = width * 10 + (*q - '0');
+    if (width > 20) return false;
+  }
+  if (*q != 'd' || strchr(q + 1, '%') != NULL) return false;
+  name_prefix_len = p - s;
+  name_width = width;
+  name_suffix = q + 1;
+  return true;
+}
+
+static void init_capture() {
+  size_t len = strlen(capture_file);
+  is_y4m = (len >= 4 && strcmp(capture_file + len - 4, ".y4m") == 0);
+  Assert(is_y4m || parse_name_pattern(capture_file),
+      "The capture file '%s' should end with .y4m or have exactly one %%d", capture_file);
+  capture_buf = malloc(SCREEN_W * SCREEN_H * 3);
+  assert(capture_buf);
+  if (is_y4m) {
+    capture_fp = fopen(capture_file, "wb");
+    Assert(capture_fp, "Can not open '%s'", capture_file);
+    setvbuf(capture_fp, NULL, _IOFBF, 1024 * 1024);
+    fprintf(capture_fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", SCREEN_W, SCREEN_H, TIMER_HZ);
+  }
+  atexit(capture_close);
+  Log("VGA is headless, the frames are captured to %s", capture_file);
+}
+#endif
+
+static void sync_screen() {
+#ifdef CONFIG_VGA_CAPTURE
+  if (headless) { capture_frame(); return; }
+#endif
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, update_screen());
+}
+
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  // the second register is the sync register
+  if (vgactl_port_base[1] != 0) {
+    sync_screen();
+    vgactl_port_base[1] = 0;
+  }
+#if defined(CONFIG_VGA_SHOW_SCREEN) && !defined(CONFIG_TARGET_AM)
+  // the render thread was busy at the last sync
+  else if (pending) retry_screen();
+#endif
+}
+
+#ifndef CONFIG_TARGET_AM
+// the guest may end right after its last sync, before vga_update_screen()
+static void vga_exit() {
+  if (vgactl_port_base[1] != 0) {
+    sync_screen();
+    vgactl_port_base[1] = 0;
+  }
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  if (!MUXDEF(CONFIG_VGA_CAPTURE, headless, false)) flush_screen();
+#endif
 }
+#endif
+
+#ifdef CONFIG_TIMELINE
+void timeline_vga_sync();
+
+static void vga_ctl_handler(uint32_t offset, int len, bool is_write) {
+  // the second register is the sync register
+  if (is_write && offset == 4 && vgactl_port_base[1] != 0) timeline_vga_sync();
+}
+#endif
 
 void init_vga() {
   vgactl_port_base = (uint32_t *)new_space(8);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, MUXDEF(CONFIG_TIMELINE, vga_ctl_handler, NULL));
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, MUXDEF(CONFIG_TIMELINE, vga_ctl_handler, NULL));
 #endif
 
   vmem = new_space(screen_size());
+#ifdef VGA_DIRTY_TILE
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), vmem_handler);
+  // the first frame is a full one
+  int ty;
+  for (ty = 0; ty < NR_TILE_Y; ty ++) vmem_dirty[ty] = (1ull << NR_TILE_X) - 1;
+#else
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
+#endif
+  memset(vmem, 0, screen_size());
+#ifdef CONFIG_VGA_CAPTURE
+  if (headless) init_capture();
+  else IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
+#else
   IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+#endif
+  // run before the exit handlers of the capture and the screen
+  IFNDEF(CONFIG_TARGET_AM, atexit(vga_exit));
 }
@@ -18,8 +18,17 @@ DIRS-y += src/cpu src/monitor src/utils
 DIRS-$(CONFIG_MODE_SYSTEM) += src/memory
 DIRS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/sdb
 
+ifndef CONFIG_GDBSTUB
+SRCS-BLACKLIST-y += src/monitor/gdbstub.c
+endif
+
+ifndef CONFIG_REPLAY
+SRCS-BLACKLIST-y += src/monitor/sdb/replay.c
+endif
+
 SHARE = $(if $(CONFIG_TARGET_SHARE),1,0)
-LIBS += $(if $(CONFIG_TARGET_NATIVE_ELF),-lreadline -ldl -pie,)
+LIBS += $(if $(CONFIG_TARGET_NATIVE_ELF),-lreadline -ldl -lpthread -pie,)
+LIBS += $(if $(CONFIG_LOG_ASYNC_GZIP),-lz,)
 
 ifdef mainargs
 ASFLAGS += -DBIN_PATH=\"$(mainargs)\"
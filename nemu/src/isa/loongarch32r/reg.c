@@ -29,3 +29,16 @@ void isa_reg_display() {
 word_t isa_reg_str2val(const char *s, bool *success) {
   return 0;
 }
+
+word_t *isa_reg_str2ptr(const char *s) {
+  int i;
+  for (i = 0; i < ARRLEN(regs); i ++) {
+    if (strcmp(regs[i], s) == 0) return &gpr(i);
+  }
+  if (strcmp("pc", s) == 0) return &cpu.pc;
+  return NULL;
+}
+
+const char *isa_reg_name(int i) {
+  return (i < ARRLEN(regs) ? regs[i] : NULL);
+}
@@ -15,7 +15,10 @@
 
 #include <isa.h>
 
+void etrace(word_t NO, vaddr_t epc);
+
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
+  IFDEF(CONFIG_ETRACE, etrace(NO, epc));
   /* TODO: Trigger an interrupt/exception with ``NO''.
    * Then return the address of the interrupt/exception vector.
    */
@@ -0,0 +1,137 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+// A built-in disassembler for riscv32, replacing capstone. It is driven by
+// the same INSTPAT() machinery and the same pattern list (instpat.h) as the
+// decoder in inst.c. Results are cached by instruction word, so
+// disassembling a hot loop is a table lookup.
+
+enum {
+  TYPE_R, TYPE_I, TYPE_IS, TYPE_IL, TYPE_S, TYPE_B,
+  TYPE_U, TYPE_J, TYPE_JR, TYPE_CSR, TYPE_CSRI, TYPE_N,
+};
+
+typedef struct {
+  uint32_t inst;
+  bool valid;
+  bool pcrel;   // the target pc + off is appended to str
+  int32_t off;
+  char str[40];
+} DisasmEntry;
+
+#define NR_ENTRY 4096
+static DisasmEntry cache[NR_ENTRY];
+
+static const char *reg[] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+static const char *csr_name(int csr) {
+  switch (csr) {
+    case 0x300: return "mstatus";
+    case 0x305: return "mtvec";
+    case 0x341: return "mepc";
+    case 0x342: return "mcause";
+    case 0x343: return "mtval";
+    case 0x340: return "mscratch";
+    case 0x180: return "satp";
+    default: return NULL;
+  }
+}
+
+static void format(DisasmEntry *e, uint32_t i, const char *name, int type) {
+  const char *rd = reg[BITS(i, 11, 7)];
+  const char *rs1 = reg[BITS(i, 19, 15)];
+  const char *rs2 = reg[BITS(i, 24, 20)];
+  int32_t immI = SEXT(BITS(i, 31, 20), 12);
+  int32_t immS = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7);
+  char *p = e->str;
+  int size = sizeof(e->str);
+
+  e->pcrel = false;
+  switch (type) {
+    case TYPE_R:  snprintf(p, size, "%s\t%s, %s, %s", name, rd, rs1, rs2); break;
+    case TYPE_I:  snprintf(p, size, "%s\t%s, %s, %d", name, rd, rs1, immI); break;
+    case TYPE_IS: snprintf(p, size, "%s\t%s, %s, %d", name, rd, rs1, (int)BITS(i, 24, 20)); break;
+    case TYPE_IL:
+    case TYPE_JR: snprintf(p, size, "%s\t%s, %d(%s)", name, rd, immI, rs1); break;
+    case TYPE_S:  snprintf(p, size, "%s\t%s, %d(%s)", name, rs2, immS, rs1); break;
+    case TYPE_U:  snprintf(p, size, "%s\t%s, 0x%x", name, rd, (int)BITS(i, 31, 12)); break;
+    case TYPE_B:
+      snprintf(p, size, "%s\t%s, %s, ", name, rs1, rs2);
+      e->pcrel = true;
+      e->off = SEXT(BITS(i, 31, 31) << 12 | BITS(i, 7, 7) << 11 |
+          BITS(i, 30, 25) << 5 | BITS(i, 11, 8) << 1, 13);
+      break;
+    case TYPE_J:
+      snprintf(p, size, "%s\t%s, ", name, rd);
+      e->pcrel = true;
+      e->off = SEXT(BITS(i, 31, 31) << 20 | BITS(i, 19, 12) << 12 |
+          BITS(i, 20, 20) << 11 | BITS(i, 30, 21) << 1, 21);
+      break;
+    case TYPE_CSR:
+    case TYPE_CSRI: {
+      int no = BITS(i, 31, 20);
+      const char *csr = csr_name(no);
+      int ret = snprintf(p, size, "%s\t%s, ", name, rd);
+      ret += (csr ? snprintf(p + ret, size - ret, "%s, ", csr) :
+                    snprintf(p + ret, size - ret, "0x%x, ", no));
+      if (type == TYPE_CSR) snprintf(p + ret, size - ret, "%s", rs1);
+      else snprintf(p + ret, size - ret, "%d", (int)BITS(i, 19, 15));
+      break;
+    }
+    case TYPE_N:  snprintf(p, size, "%s", name); break;
+    default: panic("unsupported type = %d", type);
+  }
+}
+
+static void disasm_decode(ISADecodeInfo *s, DisasmEntry *e) {
+#define INSTPAT_INST(s) ((s)->inst)
+#define INSTPAT_MATCH(s, name, type) format(e, (s)->inst, str(name), concat(TYPE_, type))
+
+  INSTPAT_START();
+#define INST(pattern, name, type, disasm_type, ...) INSTPAT(pattern, name, disasm_type);
+#include "local-include/instpat.h"
+#undef INST
+
+  e->pcrel = false;
+  snprintf(e->str, sizeof(e->str), ".word\t0x%08x", s->inst);
+  INSTPAT_END();
+}
+
+void init_disasm() {
+}
+
+void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte) {
+  assert(nbyte == 4);
+  uint32_t inst;
+  memcpy(&inst, code, 4);
+
+  DisasmEntry *e = &cache[(inst * 0x9e3779b1u) >> 20];
+  if (!e->valid || e->inst != inst) {
+    ISADecodeInfo info = { .inst = inst };
+    disasm_decode(&info, e);
+    e->inst = inst;
+    e->valid = true;
+  }
+
+  if (e->pcrel) snprintf(str, size, "%s0x%x", e->str, (uint32_t)(pc + e->off));
+  else snprintf(str, size, "%s", e->str);
+}
@@ -19,8 +19,13 @@
 #include <cpu/decode.h>
 
 #define R(i) gpr(i)       // 读/写通用寄存器
+#ifdef CONFIG_INSTSTAT
+#define Mr(addr, len) ({ g_inststat.load[len] ++; vaddr_read(addr, len); })
+#define Mw(addr, len, data) ({ g_inststat.store[len] ++; vaddr_write(addr, len, data); })
+#else
 #define Mr vaddr_read     // 读内存
 #define Mw vaddr_write    // 写内存
+#endif
 
 enum {
   TYPE_I, TYPE_U, TYPE_S,
@@ -120,6 +125,36 @@ static word_t my_mulh(word_t a, word_t b)
 }
 
 
+// a conditional branch, which is taken when `cond' is true
+#define BRANCH(cond) do { \
+  bool taken = (cond); \
+  if (taken) s->dnpc = s->pc + imm; \
+  IFDEF(CONFIG_INSTSTAT, g_inststat.branch[taken] ++); \
+} while (0)
+
+#ifdef CONFIG_FTRACE
+void ftrace_call(vaddr_t target, vaddr_t ret_addr);
+void ftrace_ret(vaddr_t target);
+void ftrace_switch(vaddr_t target, vaddr_t ret_addr);
+// ra and t0 are link registers, and the hints of return-address stack in
+// the ISA manual tell calls from returns:
+//   rd is link, rs1 is not               call
+//   rs1 is link, rd is not               return
+//   both are link and rd != rs1          return, then call (coroutine)
+//   both are link and rd == rs1          call
+#define IS_LINK(r) ((r) == 1 || (r) == 5)
+#define FTRACE_JAL()  do { if (IS_LINK(rd)) ftrace_call(s->dnpc, s->snpc); } while (0)
+#define FTRACE_JALR() do { \
+  int rs1 = BITS(s->isa.inst, 19, 15); \
+  if (!IS_LINK(rd)) { if (IS_LINK(rs1)) ftrace_ret(s->dnpc); } \
+  else if (IS_LINK(rs1) && rd != rs1) ftrace_switch(s->dnpc, s->snpc); \
+  else ftrace_call(s->dnpc, s->snpc); \
+} while (0)
+#else
+#define FTRACE_JAL()
+#define FTRACE_JALR()
+#endif
+
 static int decode_exec(Decode *s) 
 {
   s->dnpc = s->snpc; // 默认下一条PC=顺序执行PC(先假定不跳转)
@@ -130,71 +165,22 @@ static int decode_exec(Decode *s)
   word_t src1 = 0, src2 = 0, imm = 0; \
   decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
   __VA_ARGS__ ; \
+  IFDEF(CONFIG_INSTSTAT, INSTSTAT(name)); \
 }
 
   INSTPAT_START(); // 开始遍历指令模式(内部会生成一个“结束跳转点”) 用的是空参数的宏
-  // 下面每条 INSTPAT 都会展开成一个 if 匹配：
+  // 下面每条 INST 都会展开成一条 INSTPAT，即一个 if 匹配：
   // if (((inst >> shift) & mask) == key) { 执行语义; goto end; }
-  INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm);   
   /*宏展开pattern_decode(...) 把字符串模板编成 key/mask/shift。
   用 INSTPAT_INST(s) 取当前指令字（s->isa.inst）。
   判断 ((inst >> shift) & mask) == key，成立就命中这条规则。
-  进入 INSTPAT_MATCH(...)：先 decode_operand(...) 解出 rd/imm（U 型），然后执行 R(rd) = s->pc + imm。
+  进入 INSTPAT_MATCH(...)：先 decode_operand(...) 解出 rd/imm（以 auipc 为例，U 型），然后执行 R(rd) = s->pc + imm。
   goto *(__instpat_end) 跳出整个匹配过程（不再检查后面的指令规则）。*/
-
-  INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
-  INSTPAT("??????? ????? ????? 010 ????? 00000 11", lw     , I, R(rd) = Mr(src1 + imm, 4));
-  INSTPAT("??????? ????? ????? ??? ????? 01101 11", lui    , U, R(rd) = imm  ); //TYPE_U
-  INSTPAT("??????? ????? ????? 001 ????? 00000 11", lh     , I, R(rd) = (int32_t)(int16_t)Mr(src1 + imm, 2));
-  INSTPAT("??????? ????? ????? 101 ????? 00000 11", lhu    , I, R(rd) = (uint16_t)Mr(src1 + imm, 2));
-
-  INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
-  INSTPAT("??????? ????? ????? 010 ????? 01000 11", sw     , S, Mw(src1 + imm, 4, src2));
-  INSTPAT("??????? ????? ????? 001 ????? 01000 11", sh     , S, Mw(src1 + imm, 2, src2));
-  INSTPAT("0100000 ????? ????? 000 ????? 01100 11", sub    , R, R(rd) = src1 - src2 );
-  INSTPAT("??????? ????? ????? 011 ????? 00100 11", sltiu  , I, R(rd) = (src1 < imm)); 
-  INSTPAT("0100000 ????? ????? 101 ????? 00100 11", srai   , I, R(rd) = (int32_t)src1 >> BITS(imm, 4, 0) );  //无符号数字比较不用强制转换格式
-  INSTPAT("0100000 ????? ????? 101 ????? 01100 11", sra    , R, R(rd) = (int32_t)src1 >> BITS(src2, 4, 0) ); 
-  INSTPAT("0000000 ????? ????? 101 ????? 00100 11", srli   , I, R(rd) = src1 >> BITS(imm, 4, 0)  );          //逻辑右移都是直接移动
-  INSTPAT("0000000 ????? ????? 101 ????? 01100 11", srl    , R, R(rd) = src1 >> BITS(src2, 4, 0)  ); 
-  INSTPAT("0000000 ????? ????? 001 ????? 01100 11", sll    , R, R(rd) = src1 << BITS(src2, 4, 0)  ); 
-  INSTPAT("0000000 ????? ????? 001 ????? 00100 11", slli   , I, R(rd) = src1 << BITS(imm, 4, 0)  ); 
-  INSTPAT("0000000 ????? ????? 011 ????? 01100 11", sltu   , R, R(rd) = (src1 < src2)  ); 
-
-  INSTPAT("0000001 ????? ????? 100 ????? 01100 11", div    , R, R(rd) = my_div(src1, src2) );
-  INSTPAT("0000001 ????? ????? 101 ????? 01100 11", divu   , R, R(rd) = my_divu(src1, src2) );
-  INSTPAT("0000001 ????? ????? 110 ????? 01100 11", rem    , R, R(rd) = my_rem(src1, src2) );
-  INSTPAT("0000001 ????? ????? 111 ????? 01100 11", remu   , R, R(rd) = my_remu(src1, src2) );
-  
-  INSTPAT("0000001 ????? ????? 000 ????? 01100 11", mul    , R, R(rd) = my_mul(src1, src2) );
-  INSTPAT("0000001 ????? ????? 001 ????? 01100 11", mulh   , R, R(rd) = my_mulh(src1, src2) );
-
-  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
-  
-  INSTPAT("??????? ????? ????? 000 ????? 00100 11", addi   , I, R(rd) = src1 + imm ); //addi
-  INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add    , R, R(rd) = src1 + src2 );
-  INSTPAT("??????? ????? ????? 111 ????? 00100 11", andi   , I, R(rd) = src1 & imm ); 
-  INSTPAT("0000000 ????? ????? 111 ????? 01100 11", and    , R, R(rd) = src1 & src2 ); 
-
-
-  INSTPAT("??????? ????? ????? 000 ????? 11000 11", beq    , B, s->dnpc = (src1 == src2) ? s->pc + imm : s->dnpc );
-  INSTPAT("??????? ????? ????? 001 ????? 11000 11", bne    , B, s->dnpc = (src1 != src2) ? s->pc + imm : s->dnpc );
-  INSTPAT("??????? ????? ????? 111 ????? 11000 11", bgeu   , B, s->dnpc = (src1 >= src2) ? s->pc + imm : s->dnpc );
-  INSTPAT("??????? ????? ????? 101 ????? 11000 11", bge    , B, s->dnpc = ((int32_t)src1 >= (int32_t)src2) ? s->pc + imm : s->dnpc );
-  INSTPAT("??????? ????? ????? 100 ????? 11000 11", blt    , B, s->dnpc = ((int32_t)src1 < (int32_t)src2) ? s->pc + imm : s->dnpc );
-  INSTPAT("??????? ????? ????? 110 ????? 11000 11", bltu   , B, s->dnpc = ((src1 < src2) ? s->pc + imm : s->dnpc ) );
-
-  INSTPAT("??????? ????? ????? ??? ????? 11011 11", jal    , J, R(rd) = s->pc + 4; s->dnpc = s->pc + imm); //跳转用dnpc
-  INSTPAT("??????? ????? ????? 000 ????? 11001 11", jalr   , I, R(rd) = s->pc + 4; s->dnpc = (src1 + imm) & ~1); //最低位变0
-
-  INSTPAT("??????? ????? ????? 100 ????? 00100 11", xori   , I, R(rd) = src1 ^ imm );
-  INSTPAT("0000000 ????? ????? 100 ????? 01100 11", xor    , R, R(rd) = src1 ^ src2 );
-  
-  INSTPAT("0000000 ????? ????? 110 ????? 01100 11", or     , R, R(rd) = src1 | src2 );
-
+#define INST(pattern, name, type, disasm_type, ...) INSTPAT(pattern, name, type, __VA_ARGS__);
+#include "local-include/instpat.h"
+#undef INST
 
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));    //匹配所有未匹配的指令 优先级放到最后
-  //TODO 添加更多指令
 
 
 
@@ -0,0 +1,91 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// The instruction patterns of riscv32, shared by the decoder (inst.c) and
+// the disassembler (disasm.c). No include guard: the includer defines
+//   INST(pattern, name, type, disasm_type, body...)
+// and includes this file inside INSTPAT_START() / INSTPAT_END().
+// `type' selects the operands decoded for `body', and `disasm_type' the
+// format of the assembly. The decoder tries the patterns in this order.
+
+//   pattern                                     name     type disasm body
+INST("??????? ????? ????? ??? ????? 00101 11", auipc  , U,   U,     R(rd) = s->pc + imm)
+
+INST("??????? ????? ????? 100 ????? 00000 11", lbu    , I,   IL,    R(rd) = Mr(src1 + imm, 1))
+INST("??????? ????? ????? 010 ????? 00000 11", lw     , I,   IL,    R(rd) = Mr(src1 + imm, 4))
+INST("??????? ????? ????? ??? ????? 01101 11", lui    , U,   U,     R(rd) = imm) //TYPE_U
+INST("??????? ????? ????? 001 ????? 00000 11", lh     , I,   IL,    R(rd) = (int32_t)(int16_t)Mr(src1 + imm, 2))
+INST("??????? ????? ????? 101 ????? 00000 11", lhu    , I,   IL,    R(rd) = (uint16_t)Mr(src1 + imm, 2))
+
+INST("??????? ????? ????? 000 ????? 01000 11", sb     , S,   S,     Mw(src1 + imm, 1, src2))
+INST("??????? ????? ????? 010 ????? 01000 11", sw     , S,   S,     Mw(src1 + imm, 4, src2))
+INST("??????? ????? ????? 001 ????? 01000 11", sh     , S,   S,     Mw(src1 + imm, 2, src2))
+INST("0100000 ????? ????? 000 ????? 01100 11", sub    , R,   R,     R(rd) = src1 - src2)
+INST("??????? ????? ????? 011 ????? 00100 11", sltiu  , I,   I,     R(rd) = (src1 < imm))
+INST("0100000 ????? ????? 101 ????? 00100 11", srai   , I,   IS,    R(rd) = (int32_t)src1 >> BITS(imm, 4, 0))  //无符号数字比较不用强制转换格式
+INST("0100000 ????? ????? 101 ????? 01100 11", sra    , R,   R,     R(rd) = (int32_t)src1 >> BITS(src2, 4, 0))
+INST("0000000 ????? ????? 101 ????? 00100 11", srli   , I,   IS,    R(rd) = src1 >> BITS(imm, 4, 0))          //逻辑右移都是直接移动
+INST("0000000 ????? ????? 101 ????? 01100 11", srl    , R,   R,     R(rd) = src1 >> BITS(src2, 4, 0))
+INST("0000000 ????? ????? 001 ????? 01100 11", sll    , R,   R,     R(rd) = src1 << BITS(src2, 4, 0))
+INST("0000000 ????? ????? 001 ????? 00100 11", slli   , I,   IS,    R(rd) = src1 << BITS(imm, 4, 0))
+INST("0000000 ????? ????? 011 ????? 01100 11", sltu   , R,   R,     R(rd) = (src1 < src2))
+
+INST("0000001 ????? ????? 100 ????? 01100 11", div    , R,   R,     R(rd) = my_div(src1, src2))
+INST("0000001 ????? ????? 101 ????? 01100 11", divu   , R,   R,     R(rd) = my_divu(src1, src2))
+INST("0000001 ????? ????? 110 ????? 01100 11", rem    , R,   R,     R(rd) = my_rem(src1, src2))
+INST("0000001 ????? ????? 111 ????? 01100 11", remu   , R,   R,     R(rd) = my_remu(src1, src2))
+
+INST("0000001 ????? ????? 000 ????? 01100 11", mul    , R,   R,     R(rd) = my_mul(src1, src2))
+INST("0000001 ????? ????? 001 ????? 01100 11", mulh   , R,   R,     R(rd) = my_mulh(src1, src2))
+
+INST("0000000 00001 00000 000 00000 11100 11", ebreak , N,   N,     NEMUTRAP(s->pc, R(10))) // R(10) is $a0
+
+INST("??????? ????? ????? 000 ????? 00100 11", addi   , I,   I,     R(rd) = src1 + imm)
+INST("0000000 ????? ????? 000 ????? 01100 11", add    , R,   R,     R(rd) = src1 + src2)
+INST("??????? ????? ????? 111 ????? 00100 11", andi   , I,   I,     R(rd) = src1 & imm)
+INST("0000000 ????? ????? 111 ????? 01100 11", and    , R,   R,     R(rd) = src1 & src2)
+
+INST("??????? ????? ????? 000 ????? 11000 11", beq    , B,   B,     BRANCH(src1 == src2))
+INST("??????? ????? ????? 001 ????? 11000 11", bne    , B,   B,     BRANCH(src1 != src2))
+INST("??????? ????? ????? 111 ????? 11000 11", bgeu   , B,   B,     BRANCH(src1 >= src2))
+INST("??????? ????? ????? 101 ????? 11000 11", bge    , B,   B,     BRANCH((int32_t)src1 >= (int32_t)src2))
+INST("??????? ????? ????? 100 ????? 11000 11", blt    , B,   B,     BRANCH((int32_t)src1 < (int32_t)src2))
+INST("??????? ????? ????? 110 ????? 11000 11", bltu   , B,   B,     BRANCH(src1 < src2))
+
+INST("??????? ????? ????? ??? ????? 11011 11", jal    , J,   J,     R(rd) = s->pc + 4; s->dnpc = s->pc + imm; FTRACE_JAL()) //跳转用dnpc
+INST("??????? ????? ????? 000 ????? 11001 11", jalr   , I,   JR,    R(rd) = s->pc + 4; s->dnpc = (src1 + imm) & ~1; FTRACE_JALR()) //最低位变0
+
+INST("??????? ????? ????? 100 ????? 00100 11", xori   , I,   I,     R(rd) = src1 ^ imm)
+INST("0000000 ????? ????? 100 ????? 01100 11", xor    , R,   R,     R(rd) = src1 ^ src2)
+
+INST("0000000 ????? ????? 110 ????? 01100 11", or     , R,   R,     R(rd) = src1 | src2)
+
+// only disassembled, they are still invalid instructions for the decoder
+//TODO 添加更多指令
+INST("??????? ????? ????? 000 ????? 00000 11", lb     , I,   IL,    INV(s->pc))
+INST("??????? ????? ????? 010 ????? 00100 11", slti   , I,   I,     INV(s->pc))
+INST("??????? ????? ????? 110 ????? 00100 11", ori    , I,   I,     INV(s->pc))
+INST("0000000 ????? ????? 010 ????? 01100 11", slt    , R,   R,     INV(s->pc))
+INST("0000001 ????? ????? 010 ????? 01100 11", mulhsu , R,   R,     INV(s->pc))
+INST("0000001 ????? ????? 011 ????? 01100 11", mulhu  , R,   R,     INV(s->pc))
+INST("??????? ????? ????? 000 ????? 00011 11", fence  , N,   N,     INV(s->pc))
+INST("0000000 00000 00000 000 00000 11100 11", ecall  , N,   N,     INV(s->pc))
+INST("0011000 00010 00000 000 00000 11100 11", mret   , N,   N,     INV(s->pc))
+INST("??????? ????? ????? 001 ????? 11100 11", csrrw  , N,   CSR,   INV(s->pc))
+INST("??????? ????? ????? 010 ????? 11100 11", csrrs  , N,   CSR,   INV(s->pc))
+INST("??????? ????? ????? 011 ????? 11100 11", csrrc  , N,   CSR,   INV(s->pc))
+INST("??????? ????? ????? 101 ????? 11100 11", csrrwi , N,   CSRI,  INV(s->pc))
+INST("??????? ????? ????? 110 ????? 11100 11", csrrsi , N,   CSRI,  INV(s->pc))
+INST("??????? ????? ????? 111 ????? 11100 11", csrrci , N,   CSRI,  INV(s->pc))
@@ -61,3 +61,20 @@ word_t isa_reg_str2val(const char *s, bool *success)
     return 0;
   }
 }
+
+// the address of the register, or NULL if there is no such register
+word_t *isa_reg_str2ptr(const char *s)
+{
+  for (int i = 0; i < MUXDEF(CONFIG_RVE, 16, 32); i++)
+  {
+    if (strcmp(reg_name(i), s) == 0) return &gpr(i);
+  }
+  if (strcmp("pc", s) == 0) return &cpu.pc;
+  return NULL;
+}
+
+// the name of the i-th general purpose register, or NULL after the last one
+const char *isa_reg_name(int i)
+{
+  return (i < MUXDEF(CONFIG_RVE, 16, 32) ? reg_name(i) : NULL);
+}
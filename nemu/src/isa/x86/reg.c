@@ -59,3 +59,17 @@ void isa_reg_display() {
 word_t isa_reg_str2val(const char *s, bool *success) {
   return 0;
 }
+
+// only the 32-bit registers can be watched through a pointer
+word_t *isa_reg_str2ptr(const char *s) {
+  int i;
+  for (i = R_EAX; i <= R_EDI; i ++) {
+    if (strcmp(regsl[i], s) == 0) return &reg_l(i);
+  }
+  if (strcmp("pc", s) == 0) return &cpu.pc;
+  return NULL;
+}
+
+const char *isa_reg_name(int i) {
+  return (i <= R_EDI ? regsl[i] : NULL);
+}
@@ -16,7 +16,10 @@
 #include <isa.h>
 #include <memory/vaddr.h>
 
+void etrace(word_t NO, vaddr_t epc);
+
 word_t isa_raise_intr(word_t NO, vaddr_t ret_addr) {
+  IFDEF(CONFIG_ETRACE, etrace(NO, ret_addr));
   /* TODO: Trigger an interrupt/exception with ``NO''.
    * That is, use ``NO'' to index the IDT.
    */
@@ -15,7 +15,10 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
+#include <cpu/difftest.h>
+#include <cpu/cpu.h>
 #include <isa.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
@@ -32,8 +35,34 @@ static word_t pmem_read(paddr_t addr, int len) {
   return ret;
 }
 
+#ifdef CONFIG_WATCHPOINT
+static inline void wp_check_write(paddr_t addr, int len) {
+  paddr_t off = addr - CONFIG_MBASE;
+  if (unlikely(wp_block[off >> WP_BLOCK_SHIFT] | wp_block[(off + len - 1) >> WP_BLOCK_SHIFT])) {
+    wp_mem_dirty = true;
+  }
+}
+#endif
+
+#ifdef CONFIG_REPLAY
+void replay_save_page(uint32_t idx);
+word_t replay_mmio_read(paddr_t addr, int len);
+void replay_mmio_write(paddr_t addr, int len, word_t data);
+
+// save the old content of the page before its first write after a checkpoint
+static inline void replay_check_write(paddr_t addr, int len) {
+  paddr_t off = addr - CONFIG_MBASE;
+  if (unlikely(replay_page_seq[off >> PAGE_SHIFT] != replay_seq)) replay_save_page(off >> PAGE_SHIFT);
+  off += len - 1;
+  if (unlikely(replay_page_seq[off >> PAGE_SHIFT] != replay_seq)) replay_save_page(off >> PAGE_SHIFT);
+}
+#endif
+
 static void pmem_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_REPLAY, replay_check_write(addr, len));
   host_write(guest_to_host(addr), len, data);
+  IFDEF(CONFIG_DIFFTEST_MEMCHECK, difftest_mark_dirty(addr, len));
+  IFDEF(CONFIG_WATCHPOINT, wp_check_write(addr, len));
 }
 
 static void out_of_bound(paddr_t addr) {
@@ -47,18 +76,25 @@ void init_mem() {
   assert(pmem);
 #endif
   IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
+#ifdef CONFIG_WATCHPOINT
+  wp_block = calloc(CONFIG_MSIZE >> WP_BLOCK_SHIFT, sizeof(wp_block[0]));
+  assert(wp_block);
+#endif
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
-  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+  // the accesses of the debugger are not counted
+  IFDEF(CONFIG_INSTSTAT, if (g_exec_inst) g_inststat.mmio_read ++);
+  IFDEF(CONFIG_DEVICE, return MUXDEF(CONFIG_REPLAY, replay_mmio_read, mmio_read)(addr, len));
   out_of_bound(addr);
   return 0;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
-  IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+  IFDEF(CONFIG_INSTSTAT, if (g_exec_inst) g_inststat.mmio_write ++);
+  IFDEF(CONFIG_DEVICE, MUXDEF(CONFIG_REPLAY, replay_mmio_write, mmio_write)(addr, len, data); return);
   out_of_bound(addr);
 }
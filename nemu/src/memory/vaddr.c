@@ -21,9 +21,11 @@ word_t vaddr_ifetch(vaddr_t addr, int len) {
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
+  IFDEF(CONFIG_WATCHPOINT, if (unlikely(wp_nr_addr > 0)) wp_check_addr(addr, len, false));
   return paddr_read(addr, len);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_WATCHPOINT, if (unlikely(wp_nr_addr > 0)) wp_check_addr(addr, len, true));
   paddr_write(addr, len, data);
 }
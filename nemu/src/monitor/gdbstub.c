@@ -0,0 +1,458 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "sdb/sdb.h"
+#include "sdb/watchpoint.h"
+
+/* GDB remote serial protocol stub. It listens on a TCP port of localhost or
+ * a Unix socket, and serves one gdb until it detaches or kills the guest.
+ * While the guest is running, SIGIO on the socket stops the execution loop,
+ * so that gdb can interrupt it with Ctrl-C.
+ */
+
+
+#define PACKET_SIZE 0x4000
+#define NR_GPR MUXDEF(CONFIG_RVE, 16, 32)
+#define NR_REG (NR_GPR + 1)   // pc follows the GPRs
+#define XLEN (sizeof(word_t) * 8)
+
+static int fd = -1;
+static bool no_ack = false;
+static volatile sig_atomic_t running = false;
+static volatile sig_atomic_t interrupted = false;
+static bool stepping = false;  // the last stop is by a single step
+
+static char in_buf[PACKET_SIZE * 2];
+static int in_len = 0, in_pos = 0;
+static char pkt[PACKET_SIZE * 2 + 16];    // the packet received
+static char reply[PACKET_SIZE * 2 + 16];  // the packet to send
+
+static const char *gdb_reg_name[] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+// ----------- socket -----------
+
+static void sigio_handler(int sig) {
+  // gdb only sends Ctrl-C while the guest is running, and
+  // the state set when the guest ends must not be overwritten
+  if (running && nemu_state.state == NEMU_RUNNING) {
+    interrupted = true;
+    nemu_state.state = NEMU_STOP;
+  }
+}
+
+static int get_char() {
+  if (in_pos == in_len) {
+    in_len = recv(fd, in_buf, sizeof(in_buf), 0);
+    in_pos = 0;
+    if (in_len <= 0) { in_len = 0; return -1; }
+  }
+  return (uint8_t)in_buf[in_pos ++];
+}
+
+static void put_raw(const char *s, int len) {
+  while (len > 0) {
+    int n = send(fd, s, len, MSG_NOSIGNAL);
+    if (n <= 0) return;
+    s += n;
+    len -= n;
+  }
+}
+
+static const char hex[] = "0123456789abcdef";
+
+static int hex_val(int c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static void send_packet(const char *data, int len) {
+  static char buf[sizeof(reply) + 4];
+  uint8_t sum = 0;
+  int i;
+  buf[0] = '$';
+  for (i = 0; i < len; i ++) { buf[i + 1] = data[i]; sum += (uint8_t)data[i]; }
+  buf[len + 1] = '#';
+  buf[len + 2] = hex[sum >> 4];
+  buf[len + 3] = hex[sum & 0xf];
+  while (true) {
+    put_raw(buf, len + 4);
+    if (no_ack) return;
+    int c = get_char();
+    if (c == '-') continue;
+    // not an ack, leave it to recv_packet()
+    if (c >= 0 && c != '+') in_pos --;
+    return;
+  }
+}
+
+static void send_str(const char *s) { send_packet(s, strlen(s)); }
+
+// return the length of the packet, or -1 if gdb is gone
+static int recv_packet() {
+  int c;
+  while (true) {
+    // skip acks and interrupts between packets
+    do { c = get_char(); } while (c >= 0 && c != '$');
+    if (c < 0) return -1;
+    int len = 0;
+    uint8_t sum = 0;
+    while ((c = get_char()) >= 0 && c != '#') {
+      if (len < sizeof(pkt) - 1) pkt[len ++] = c;
+      sum += c;
+    }
+    if (c < 0) return -1;
+    int c1 = get_char(), c2 = get_char();
+    if (c2 < 0) return -1;
+    pkt[len] = '\0';
+    if (no_ack) return len;
+    if (hex_val(c1) * 16 + hex_val(c2) == sum) { put_raw("+", 1); return len; }
+    put_raw("-", 1);
+  }
+}
+
+static bool gdb_listen(const char *addr) {
+  int sfd;
+  if (strncmp(addr, "unix:", 5) == 0) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", addr + 5);
+    unlink(sa.sun_path);
+    sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sfd < 0 || bind(sfd, (struct sockaddr *)&sa, sizeof(sa)) < 0) return false;
+  } else {
+    const char *port = strrchr(addr, ':');
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+      .sin_port = htons(atoi(port ? port + 1 : addr)) };
+    int one = 1;
+    sfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sfd < 0) return false;
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(sfd, (struct sockaddr *)&sa, sizeof(sa)) < 0) return false;
+  }
+  if (listen(sfd, 1) < 0) return false;
+  Log("Waiting for gdb on %s", addr);
+  fd = accept(sfd, NULL, NULL);
+  close(sfd);
+  if (fd < 0) return false;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  signal(SIGIO, sigio_handler);
+  fcntl(fd, F_SETOWN, getpid());
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_ASYNC);
+  return true;
+}
+
+// ----------- registers and memory -----------
+
+static word_t *reg_ptr(int n) {
+  if (n < NR_GPR) return &cpu.gpr[n];
+  if (n == NR_GPR) return &cpu.pc;
+  return NULL;
+}
+
+static char *put_word(char *p, word_t val) {
+  int i;
+  for (i = 0; i < sizeof(word_t); i ++, val >>= 8) {
+    *p ++ = hex[(val >> 4) & 0xf];
+    *p ++ = hex[val & 0xf];
+  }
+  return p;
+}
+
+static word_t get_word(const char *p) {
+  word_t val = 0;
+  int i;
+  for (i = sizeof(word_t) - 1; i >= 0; i --) {
+    val = (val << 8) | (hex_val(p[i * 2]) << 4) | hex_val(p[i * 2 + 1]);
+  }
+  return val;
+}
+
+// only pmem is accessed, to avoid the side effects of MMIO
+static bool mem_ok(word_t addr, word_t len) {
+  return len == 0 || (in_pmem(addr) && in_pmem(addr + len - 1) && addr + len - 1 >= addr);
+}
+
+static void read_regs() {
+  char *p = reply;
+  int i;
+  for (i = 0; i < NR_REG; i ++) p = put_word(p, *reg_ptr(i));
+  send_packet(reply, p - reply);
+}
+
+static void write_regs(const char *p) {
+  int i;
+  for (i = 0; i < NR_REG && strlen(p) >= sizeof(word_t) * 2; i ++, p += sizeof(word_t) * 2) {
+    *reg_ptr(i) = get_word(p);
+  }
+  IFDEF(CONFIG_ISA_riscv, cpu.gpr[0] = 0);
+  send_str("OK");
+}
+
+static void read_mem(const char *args, bool binary) {
+  uint64_t addr, len;
+  if (sscanf(args, "%" SCNx64 ",%" SCNx64, &addr, &len) != 2) { send_str("E01"); return; }
+  if (len > PACKET_SIZE / 2) len = PACKET_SIZE / 2;
+  if (!mem_ok(addr, len)) { send_str("E14"); return; }
+  uint8_t *src = guest_to_host(addr);
+  char *p = reply;
+  uint64_t i;
+  if (binary) {
+    // the reply to `x' starts with `b', and the special characters are escaped
+    *p ++ = 'b';
+    for (i = 0; i < len; i ++) {
+      uint8_t c = src[i];
+      if (c == '$' || c == '#' || c == '}' || c == '*') { *p ++ = '}'; c ^= 0x20; }
+      *p ++ = c;
+    }
+  } else {
+    for (i = 0; i < len; i ++) {
+      *p ++ = hex[src[i] >> 4];
+      *p ++ = hex[src[i] & 0xf];
+    }
+  }
+  send_packet(reply, p - reply);
+}
+
+static void write_mem(const char *args, int pkt_len, bool binary) {
+  uint64_t addr, len;
+  const char *data = strchr(args, ':');
+  if (data == NULL || sscanf(args, "%" SCNx64 ",%" SCNx64, &addr, &len) != 2) { send_str("E01"); return; }
+  data ++;
+  if (!mem_ok(addr, len)) { send_str("E14"); return; }
+  uint8_t *dst = guest_to_host(addr);
+  const char *end = pkt + pkt_len;
+  uint64_t i;
+  for (i = 0; i < len; i ++) {
+    if (binary) {
+      if (data >= end) break;
+      uint8_t c = *data ++;
+      if (c == '}' && data < end) c = *data ++ ^ 0x20;
+      dst[i] = c;
+    } else {
+      if (data + 1 >= end) break;
+      dst[i] = hex_val(data[0]) * 16 + hex_val(data[1]);
+      data += 2;
+    }
+  }
+  send_str(i == len ? "OK" : "E01");
+}
+
+// ----------- execution -----------
+
+static void report_stop() {
+  char buf[32];
+  switch (nemu_state.state) {
+    case NEMU_END:
+      snprintf(buf, sizeof(buf), "W%02x", nemu_state.halt_ret & 0xff);
+      break;
+    case NEMU_ABORT: case NEMU_QUIT:
+      snprintf(buf, sizeof(buf), "X%02x", 6); // SIGABRT
+      break;
+    default: {
+      // SIGINT for Ctrl-C, otherwise SIGTRAP with the reason of the stop
+      if (interrupted) { snprintf(buf, sizeof(buf), "T02thread:1;"); break; }
+      int p = snprintf(buf, sizeof(buf), "T05thread:1;");
+#ifdef CONFIG_WATCHPOINT
+      paddr_t addr;
+      int type = wp_addr_hit(&addr);
+      if (type >= 0) {
+        const char *name = (type == WP_WRITE ? "watch" : type == WP_READ ? "rwatch" : "awatch");
+        snprintf(buf + p, sizeof(buf) - p, "%s:%" PRIx64 ";", name, (uint64_t)addr);
+        break;
+      }
+#endif
+      if (g_stop_by_bp && !stepping) snprintf(buf + p, sizeof(buf) - p, "swbreak:;");
+      break;
+    }
+  }
+  send_str(buf);
+}
+
+static void resume(bool step, const char *addr) {
+  if (addr != NULL && *addr != '\0') cpu.pc = strtoull(addr, NULL, 16);
+  interrupted = false;
+  stepping = step;
+  running = true;
+  cpu_exec(step ? 1 : -1);
+  running = false;
+  // an interrupt which arrives just after the execution is not a stop
+  if (in_pos < in_len && in_buf[in_pos] == 0x03) { in_pos ++; interrupted = true; }
+  report_stop();
+}
+
+static bool ended() {
+  return nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT ||
+    nemu_state.state == NEMU_QUIT;
+}
+
+static void handle_vcont(const char *args) {
+  if (strcmp(args, "?") == 0) { send_str("vCont;c;C;s;S"); return; }
+  // only one thread, so the first action applies
+  if (args[0] != ';') { send_str(""); return; }
+  char action = args[1];
+  if (action == 's' || action == 'S') resume(true, NULL);
+  else if (action == 'c' || action == 'C') resume(false, NULL);
+  else send_str("");
+}
+
+static void handle_query(const char *p) {
+  if (strncmp(p, "qSupported", 10) == 0) {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+;"
+        "vContSupported+;swbreak+;binary-upload+%s", PACKET_SIZE,
+        MUXDEF(CONFIG_REPLAY, ";ReverseStep+;ReverseContinue+", ""));
+    send_str(buf);
+  }
+  else if (strncmp(p, "qXfer:features:read:target.xml:", 31) == 0) {
+    static char xml[4096];
+    if (xml[0] == '\0') {
+      char *q = xml;
+      q += sprintf(q, "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+          "<target version=\"1.0\"><architecture>riscv:rv%d</architecture>"
+          "<feature name=\"org.gnu.gdb.riscv.cpu\">", (int)XLEN);
+      int i;
+      for (i = 0; i < NR_GPR; i ++) {
+        q += sprintf(q, "<reg name=\"%s\" bitsize=\"%d\" type=\"%s\" regnum=\"%d\"/>", gdb_reg_name[i],
+            (int)XLEN, (i == 2 ? "data_ptr" : i == 1 ? "code_ptr" : "int"), i);
+      }
+      sprintf(q, "<reg name=\"pc\" bitsize=\"%d\" type=\"code_ptr\" regnum=\"%d\"/></feature></target>",
+          (int)XLEN, NR_GPR);
+    }
+    unsigned off, len;
+    if (sscanf(p + 31, "%x,%x", &off, &len) != 2) { send_str("E01"); return; }
+    int total = strlen(xml);
+    if (off >= total) { send_str("l"); return; }
+    if (len > PACKET_SIZE - 1) len = PACKET_SIZE - 1;
+    int n = (total - off < len ? total - off : len);
+    reply[0] = (off + n < total ? 'm' : 'l');
+    memcpy(reply + 1, xml + off, n);
+    send_packet(reply, n + 1);
+  }
+  else if (strcmp(p, "QStartNoAckMode") == 0) { send_str("OK"); no_ack = true; }
+  else if (strcmp(p, "qAttached") == 0) send_str("1");
+  else if (strcmp(p, "qC") == 0) send_str("QC1");
+  else if (strcmp(p, "qfThreadInfo") == 0) send_str("m1");
+  else if (strcmp(p, "qsThreadInfo") == 0) send_str("l");
+  else send_str("");
+}
+
+static void handle_breakpoint(const char *p, bool insert) {
+  uint64_t addr;
+  int type;
+  unsigned kind = 0;
+  if (sscanf(p + 1, "%d,%" SCNx64 ",%x", &type, &addr, &kind) < 2) { send_str("E01"); return; }
+#ifdef CONFIG_WATCHPOINT
+  // write, read and access watchpoints, whose kind is the length
+  if (type >= 2 && type <= 4) {
+    int len = kind;
+    if (len <= 0) { send_str("E01"); return; }
+    bool ok = (insert ? wp_add_addr(addr, len, type) : wp_del_addr(addr, len, type));
+    send_str(ok ? "OK" : "E01");
+    return;
+  }
+#endif
+  // software and hardware breakpoints are the same
+  if (type != 0 && type != 1) { send_str(""); return; }
+  if (insert) send_str(bp_add(addr, NULL) > 0 ? "OK" : "E01");
+  else send_str(bp_del_addr(addr) ? "OK" : "E01");
+}
+
+void gdb_mainloop(const char *addr) {
+  Assert(gdb_listen(addr), "Can not listen on '%s' for gdb", addr);
+  Log("gdb is connected");
+  bool detached = false;
+  int len;
+  while ((len = recv_packet()) >= 0) {
+    char *p = pkt;
+    switch (p[0]) {
+      case '?': report_stop(); break;
+      case 'g': read_regs(); break;
+      case 'G': write_regs(p + 1); break;
+      case 'p': {
+        word_t *r = reg_ptr(strtol(p + 1, NULL, 16));
+        if (r == NULL) { send_str("E01"); break; }
+        send_packet(reply, put_word(reply, *r) - reply);
+        break;
+      }
+      case 'P': {
+        char *eq = strchr(p, '=');
+        word_t *r = reg_ptr(strtol(p + 1, NULL, 16));
+        if (r == NULL || eq == NULL) { send_str("E01"); break; }
+        if (r != &cpu.gpr[0]) *r = get_word(eq + 1);
+        send_str("OK");
+        break;
+      }
+      case 'm': read_mem(p + 1, false); break;
+      case 'x': read_mem(p + 1, true); break;
+      case 'M': write_mem(p + 1, len, false); break;
+      case 'X': write_mem(p + 1, len, true); break;
+      case 'c': if (ended()) report_stop(); else resume(false, p + 1); break;
+      case 's': if (ended()) report_stop(); else resume(true, p + 1); break;
+#ifdef CONFIG_REPLAY
+      case 'b':
+        // tell gdb when the beginning of the record is reached
+        if (p[1] != 's' && p[1] != 'c') { send_str(""); break; }
+        interrupted = false;
+        stepping = (p[1] == 's');
+        if (p[1] == 's' ? replay_step_back(1) : replay_continue_back()) report_stop();
+        else send_str("T05replaylog:begin;");
+        break;
+#endif
+      case 'v':
+        if (strncmp(p, "vCont", 5) == 0) {
+          if (ended() && p[5] != '?') report_stop();
+          else handle_vcont(p + 5);
+        }
+        else send_str("");
+        break;
+      case 'Z': handle_breakpoint(p, true); break;
+      case 'z': handle_breakpoint(p, false); break;
+      case 'q': case 'Q': handle_query(p); break;
+      case 'H': case 'T': send_str("OK"); break;
+      case 'D': send_str("OK"); detached = true; goto out;
+      case 'k': goto out;
+      default: send_str(""); break;
+    }
+  }
+out:
+  close(fd);
+  fd = -1;
+  Log("gdb is disconnected");
+  // after detaching, the guest runs on by itself
+  if (detached) {
+    while (!ended()) cpu_exec(-1);
+  }
+  if (!ended()) nemu_state.state = NEMU_QUIT;
+}
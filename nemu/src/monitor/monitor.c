@@ -18,11 +18,18 @@
 
 void init_rand();
 void init_log(const char *log_file);
+void init_bintrace(const char *file);
 void init_mem();
 void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm();
+void init_ftrace();
+void init_pcsample();
+void init_dtrace();
+void init_timeline();
+void init_replay();
+bool itrace_config(const char *args);
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
@@ -39,10 +46,17 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void sdb_set_gdb(const char *addr);
+void sdb_set_script(const char *file);
+void json_init(const char *file);
+void vga_set_headless(const char *file);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *elf_file = NULL;
+static char *trace_arg[16] = {};
+static int nr_trace_arg = 0;
 static int difftest_port = 1234;
 
 static long load_img() {
@@ -73,23 +87,62 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"elf"      , required_argument, NULL, 'e'},
+    {"trace"    , required_argument, NULL, 't'},
+    {"gdb"      , required_argument, NULL, 'g'},
+    {"script"   , required_argument, NULL, 's'},
+    {"json"     , required_argument, NULL, 'j'},
+    {"headless" , optional_argument, NULL, 'H'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:t:g:s:j:H::", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
-      case 'd': diff_so_file = optarg; break;
+      case 'e': elf_file = optarg; break;
+      case 's': sdb_set_script(optarg); break;
+      case 'j': json_init(optarg); break;
+      case 't':
+        // applied after the symbols are read
+        Assert(nr_trace_arg < ARRLEN(trace_arg), "Too many --trace options");
+        trace_arg[nr_trace_arg ++] = optarg;
+        break;
+      case 'H':
+        MUXDEF(CONFIG_VGA_CAPTURE, vga_set_headless(optarg),
+            panic("--headless is not supported since the VGA capture is disabled"));
+        break;
+      case 'g':
+        MUXDEF(CONFIG_GDBSTUB, sdb_set_gdb(optarg),
+            panic("--gdb is not supported since the GDB stub is disabled"));
+        break;
+      case 'd':
+        // more than one REF can be given, they are joined with commas
+        if (diff_so_file == NULL) diff_so_file = optarg;
+        else {
+          char *s = malloc(strlen(diff_so_file) + strlen(optarg) + 2);
+          sprintf(s, "%s,%s", diff_so_file, optarg);
+          diff_so_file = s;
+        }
+        break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
         printf("\t-b,--batch              run with batch mode\n");
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
+        printf("\t                        (can be given more than once, or as a comma-separated list)\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-e,--elf=FILE           read function symbols from the ELF file of IMAGE\n");
+        printf("\t-t,--trace=ARGS         control the trace window as the `trace' command,\n");
+        printf("\t                        e.g. --trace='inst 1000 2000' --trace='func main'\n");
+        printf("\t-s,--script=FILE        run sdb commands in FILE (- for stdin) instead of the prompt\n");
+        printf("\t-j,--json=FILE          write the results of the run to FILE in JSON\n");
+        printf("\t-H,--headless[=FILE]    capture the VGA frames to FILE instead of showing them\n");
+        printf("\t-g,--gdb=ADDR           wait for gdb on ADDR, which is a port of localhost\n");
+        printf("\t                        or unix:PATH, instead of running sdb\n");
         printf("\n");
         exit(0);
     }
@@ -111,12 +164,17 @@ void init_monitor(int argc, char *argv[])
 
   /* Open the log file. */
   init_log(log_file);
+  IFDEF(CONFIG_ITRACE_BINARY, init_bintrace(CONFIG_ITRACE_BINARY_FILE));
+  IFDEF(CONFIG_TIMELINE, init_timeline());
 
   /* Initialize memory. */
   init_mem();
 
   /* Initialize devices. */
   IFDEF(CONFIG_DEVICE, init_device());
+#if defined(CONFIG_DTRACE) || defined(CONFIG_ETRACE)
+  init_dtrace();
+#endif
 
   /* Perform ISA dependent initialization. */
   init_isa();
@@ -124,13 +182,25 @@ void init_monitor(int argc, char *argv[])
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
+  /* Read symbols of the guest program. */
+  init_elf(elf_file);
+  IFDEF(CONFIG_FTRACE, init_ftrace());
+  for (int i = 0; i < nr_trace_arg; i ++) {
+    MUXDEF(CONFIG_TRACE, Assert(itrace_config(trace_arg[i]), "Invalid --trace option '%s'", trace_arg[i]),
+        Log("--trace=%s is ignored since the tracers are disabled", trace_arg[i]));
+  }
+  IFDEF(CONFIG_PCSAMPLE, init_pcsample());
+
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
   /* Initialize the simple debugger. */
   init_sdb();
+  IFDEF(CONFIG_REPLAY, init_replay());
 
-  IFDEF(CONFIG_ITRACE, init_disasm());
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE) || defined(CONFIG_PCSAMPLE)
+  init_disasm();
+#endif
 
   /* Display welcome message. */
   welcome();
@@ -0,0 +1,166 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include "sdb.h"
+
+/* PC breakpoints. The execution loop checks bp_page[] of the next pc after
+ * every instruction, which is non-zero only for the pages with breakpoints,
+ * and bp_hit() looks up the hashed set only in these pages.
+ */
+
+#define NR_BP 32
+#define BP_HASH_SIZE 64   // must be a power of 2 and larger than NR_BP
+
+typedef struct {
+  int NO;        // -1 means free
+  vaddr_t addr;
+  char *cond_str;
+  ExprCode *cond;  // NULL for unconditional breakpoints
+  uint64_t hits;
+} BP;
+
+static BP bp_pool[NR_BP] = {};
+static int bp_hash[BP_HASH_SIZE] = {};   // index in bp_pool + 1, 0 means empty
+static int next_no = 1;
+
+// number of breakpoints in every page of pmem
+uint8_t bp_page[CONFIG_MSIZE >> PAGE_SHIFT] = {};
+
+static inline uint32_t hash(vaddr_t addr) {
+  return ((uint32_t)addr >> 2) * 0x9e3779b1u >> (32 - 6);
+}
+
+static int bp_find(vaddr_t addr) {
+  uint32_t h = hash(addr) & (BP_HASH_SIZE - 1);
+  while (bp_hash[h] != 0) {
+    if (bp_pool[bp_hash[h] - 1].addr == addr) return bp_hash[h] - 1;
+    h = (h + 1) & (BP_HASH_SIZE - 1);
+  }
+  return -1;
+}
+
+static void rehash() {
+  memset(bp_hash, 0, sizeof(bp_hash));
+  int i;
+  for (i = 0; i < NR_BP; i ++) {
+    if (bp_pool[i].NO <= 0) continue;
+    uint32_t h = hash(bp_pool[i].addr) & (BP_HASH_SIZE - 1);
+    while (bp_hash[h] != 0) h = (h + 1) & (BP_HASH_SIZE - 1);
+    bp_hash[h] = i + 1;
+  }
+}
+
+static const char *symbol(vaddr_t addr, char *buf, int size) {
+  int idx = elf_func_index(addr);
+  if (idx < 0) buf[0] = '\0';
+  else if (addr == elf_func_addr(idx)) snprintf(buf, size, " <%s>", elf_func_name(idx));
+  else snprintf(buf, size, " <%s+0x%x>", elf_func_name(idx), (uint32_t)(addr - elf_func_addr(idx)));
+  return buf;
+}
+
+// return the number of the new breakpoint, or -1 on failure
+int bp_add(vaddr_t addr, char *cond) {
+  if (!in_pmem(addr)) {
+    printf("Breakpoint at " FMT_WORD " is not in pmem\n", addr);
+    return -1;
+  }
+  int i = bp_find(addr);
+  if (i >= 0) {
+    printf("Breakpoint %d is already at " FMT_WORD "\n", bp_pool[i].NO, addr);
+    return -1;
+  }
+  for (i = 0; i < NR_BP; i ++) {
+    if (bp_pool[i].NO <= 0) break;
+  }
+  if (i == NR_BP) {
+    printf("Too many breakpoints\n");
+    return -1;
+  }
+
+  ExprCode *code = NULL;
+  if (cond != NULL) {
+    bool success;
+    code = expr_compile(cond, &success);
+    if (!success) {
+      printf("Invalid condition '%s'\n", cond);
+      return -1;
+    }
+  }
+  bp_pool[i] = (BP) { .NO = next_no ++, .addr = addr, .cond = code,
+    .cond_str = (cond ? strdup(cond) : NULL) };
+  bp_page[(addr - CONFIG_MBASE) >> PAGE_SHIFT] ++;
+  rehash();
+  return bp_pool[i].NO;
+}
+
+bool bp_del(int no) {
+  int i;
+  for (i = 0; i < NR_BP; i ++) {
+    BP *bp = &bp_pool[i];
+    if (bp->NO != no) continue;
+    bp_page[(bp->addr - CONFIG_MBASE) >> PAGE_SHIFT] --;
+    free(bp->cond);
+    free(bp->cond_str);
+    bp->NO = -1;
+    rehash();
+    return true;
+  }
+  return false;
+}
+
+// whether an unconditional breakpoint is at `addr'
+bool bp_at(vaddr_t addr) {
+  int i = bp_find(addr);
+  return i >= 0 && bp_pool[i].cond == NULL;
+}
+
+bool bp_del_addr(vaddr_t addr) {
+  int i = bp_find(addr);
+  return i >= 0 && bp_del(bp_pool[i].NO);
+}
+
+void bp_display() {
+  char sym[64];
+  int i;
+  bool empty = true;
+  for (i = 0; i < NR_BP; i ++) {
+    BP *bp = &bp_pool[i];
+    if (bp->NO <= 0) continue;
+    if (empty) printf("No  Address     Hits        Where\n");
+    empty = false;
+    printf("%-3d " FMT_WORD "  %-10" PRIu64 "  %s%s%s\n", bp->NO, bp->addr, bp->hits,
+        symbol(bp->addr, sym, sizeof(sym)), (bp->cond ? " if " : ""), (bp->cond ? bp->cond_str : ""));
+  }
+  if (empty) printf("No breakpoints.\n");
+}
+
+// called when bp_page[] of `pc' is non-zero, return true to stop
+bool bp_hit(vaddr_t pc) {
+  int i = bp_find(pc);
+  if (i < 0) return false;
+  BP *bp = &bp_pool[i];
+  if (bp->cond != NULL) {
+    bool success;
+    word_t val = expr_run(bp->cond, &success);
+    if (success && val == 0) return false;
+  }
+  bp->hits ++;
+  char sym[64];
+  printf("Breakpoint %d at " FMT_WORD "%s\n", bp->NO, pc, symbol(pc, sym, sizeof(sym)));
+  return true;
+}
@@ -21,6 +21,7 @@
 #include <regex.h>// 包含正则表达式库，用于模式匹配
 #include <common.h> //assert
 #include <memory/vaddr.h>
+#include "sdb.h"
 
 int div_zero_count = 0;//全局变量 记录除0次数
 
@@ -80,10 +81,13 @@ static struct rule {
 #define NR_REGEX ARRLEN(rules)   //计算长度
 
 // 编译后的正则表达式数组：存储编译好的 regex_t 对象
-static regex_t re[NR_REGEX] = {};
+// 每个线程各有一份, 多个线程同时调用 expr() 时 regexec() 不会争用同一把锁
+static __thread regex_t re[NR_REGEX] = {};
+static __thread bool re_ready = false;
 
 /* Rules are used for many times.
  * Therefore we compile them only once before any usage.
+ * Other threads compile their own copy on their first call to expr().
  */
 void init_regex() 
 {
@@ -101,6 +105,16 @@ void init_regex()
       panic("regex compilation failed: %s\n%s", error_msg, rules[i].regex);
     }
   }
+  re_ready = true;
+}
+
+// release the rules of the calling thread
+void free_regex()
+{
+  int i;
+  if (!re_ready) return;
+  for (i = 0; i < NR_REGEX; i ++) regfree(&re[i]);
+  re_ready = false;
 }
 
 
@@ -108,12 +122,13 @@ void init_regex()
 typedef struct token 
 {
   int type;             // 标记类型（如 '+' 或 TK_EQ）
-  char str[1024];         // 标记的字符串内容（最多 31 字符 + 结束符）
+  char str[32];           // 标记的字符串内容（最多 31 字符 + 结束符）
 } Token;
 // 全局标记数组：存储解析出的标记
-static Token tokens[1024] __attribute__((used)) = {};// 防止被优化掉
+// 以下求值用到的状态都是线程局部的, 见 fuzz.c
+static __thread Token tokens[1024] __attribute__((used)) = {};// 防止被优化掉
 // 当前标记数量
-static int nr_token __attribute__((used))  = 0;
+static __thread int nr_token __attribute__((used))  = 0;
 
 
 
@@ -124,6 +139,7 @@ static bool make_token(char *e) {
   regmatch_t pmatch; //起止位置
 
   nr_token = 0;// 重置标记数量
+  if (!re_ready) init_regex();
 
   while (e[position] != '\0') {
     /* Try all rules one by one. NR_REGEX 规则的数量*/
@@ -385,140 +401,178 @@ static int find_main_op(int p, int q)  //不能直接用 要对表达式进行
 }
 
 
-bool div_zero_flag = false; //除0标志
+__thread bool div_zero_flag = false; //除0标志
 
-static uint32_t eval(int p, int q, bool *success)  //两个bug(1+2) + (3+4)会因为外面括号去掉 报错 以及除0的时候报错
-{
-  if(!*success)
-    return 0;
+/* Expressions are compiled into a stack bytecode once, and the bytecode can
+ * be run many times without tokenizing again, e.g. for watchpoints.
+ * Registers are resolved to pointers and constant subexpressions are folded
+ * at compile time.
+ */
+enum {
+  OP_IMM, OP_REG, OP_MEM,   // push an immediate, a register, or the memory at a constant address
+  OP_DREF, OP_NEG, OP_BOOL, // unary
+  OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_EQ, OP_NEQ, OP_LE, // binary
+  OP_JZ, OP_JNZ, OP_JMP,    // jumps for && and ||, JZ and JNZ pop the condition
+};
+
+typedef struct {
+  int op;
+  union {
+    word_t imm;
+    word_t *reg;
+    int target;
+  };
+} ExprInst;
+
+struct ExprCode {
+  int nr_inst;
+  int max_depth;
+  ExprInst inst[];
+};
+
+static __thread ExprInst code[1024];
+static __thread int nr_code = 0;
+static __thread int depth = 0, max_depth = 0;
 
+static bool emit(int op, word_t imm) {
+  if (nr_code == ARRLEN(code)) {
+    printf(ANSI_FMT("Expr is too long", ANSI_BG_RED) "\n");
+    return false;
+  }
+  code[nr_code ++] = (ExprInst) { .op = op, .imm = imm };
+  switch (op) {
+    case OP_IMM: case OP_REG: case OP_MEM: depth ++; break;
+    case OP_DREF: case OP_NEG: case OP_BOOL: case OP_JMP: break;
+    default: depth --; break;
+  }
+  if (depth > max_depth) max_depth = depth;
+  return true;
+}
+
+static inline bool is_imm(int start) {
+  return nr_code - start == 1 && code[start].op == OP_IMM;
+}
+
+static inline word_t alu(int op, word_t val1, word_t val2) {
+  switch (op) {
+    case OP_ADD:  return val1 + val2;
+    case OP_SUB:  return val1 - val2;
+    case OP_MUL:  return val1 * val2;
+    // the quotient of INT_MIN / -1 overflows and raises SIGFPE on x86
+    case OP_DIV:  return (val2 == (word_t)-1 ? -val1 : (sword_t)val1 / (sword_t)val2); //一定会舍弃小数
+    case OP_EQ:   return (val1 == val2);
+    case OP_NEQ:  return (val1 != val2);
+    case OP_LE:   return ((sword_t)val1 <= (sword_t)val2);
+    default: panic("bad op %d", op);
+  }
+}
+
+static bool gen(int p, int q);
+
+// code for `a && b' and `a || b':
+//   a; JZ/JNZ L1; b; BOOL; JMP L2; L1: IMM 0/1; L2:
+static bool gen_logic(int p, int op, int q) {
+  bool is_and = (tokens[op].type == TK_L_AND);
+  if (!gen(p, op - 1)) return false;
+  int jcond = nr_code;
+  if (!emit(is_and ? OP_JZ : OP_JNZ, 0)) return false;
+  if (!gen(op + 1, q) || !emit(OP_BOOL, 0)) return false;
+  int jend = nr_code;
+  if (!emit(OP_JMP, 0)) return false;
+  code[jcond].target = nr_code;
+  depth --; // the two paths push only one value
+  if (!emit(OP_IMM, !is_and)) return false;
+  code[jend].target = nr_code;
+  return true;
+}
+
+static bool gen(int p, int q)  //两个bug(1+2) + (3+4)会因为外面括号去掉 报错 以及除0的时候报错
+{
   if(p > q)
   {
     printf(ANSI_FMT("Bad expr", ANSI_BG_RED) "\n");
-    *success = false;
-    return 0;
+    return false;
   }
   else if(p == q) //单个token 整数或者寄存器
   {
     if(tokens[p].type == TK_DEC)
-      return strtoul(tokens[p].str, NULL, 10);//?;
+      return emit(OP_IMM, strtoul(tokens[p].str, NULL, 10));
     else if(tokens[p].type == TK_REG)
     {
-      
-      return isa_reg_str2val(tokens[p].str, success);
+      word_t *reg = isa_reg_str2ptr(tokens[p].str);
+      if (reg == NULL) {
+        printf("CANT FIND REG\n");
+        return false;
+      }
+      if (!emit(OP_REG, 0)) return false;
+      code[nr_code - 1].reg = reg;
+      return true;
     }
     else if(tokens[p].type == TK_HEX)
     {
-      return strtoul(tokens[p].str, NULL, 16);//16进制
+      return emit(OP_IMM, strtoul(tokens[p].str, NULL, 16));//16进制
     }
     else
-    {  
+    {
       printf(ANSI_FMT("Bad expr", ANSI_BG_RED) "\n");
-      *success = false;
-      return 0;
+      return false;
     }
   }
-
-  
   else if(check_bracket(p, q) == true)
   {
-    return eval(p+1, q-1, success);//去掉外面的括号 递归求值
+    return gen(p+1, q-1);//去掉外面的括号 递归编译
   }
-  else 
-  {
-    int op = find_main_op(p, q); //以主操作符为中心分割表达式
-    if(op == -1) //主运算符查找错误的返回值
-    {
-      printf(ANSI_FMT("Bad expr", ANSI_BG_RED) "\n");
-      *success = false; //遇到错误才false 默认是true
-        return 0;
-    }
 
-    uint32_t val1, val2;
-
-    if(tokens[op].type == TK_NEG || tokens[op].type == TK_UPLUS)
-    {
-      val2 = eval(op+1, q, success);  // 一元只用右边
-      return (tokens[op].type == TK_NEG) ? -val2 : val2;
-    }
-
-    else if (tokens[op].type == TK_DREF) 
-    {
-      uint32_t addr = eval(op + 1, q, success);
-      if (!*success) return 0;
-      return vaddr_read(addr, 4);
-    }
-    //上面这个if 全是一元运算符的
-    
-    if(tokens[op].type == TK_L_AND)//短路算逻辑与
-    {
-      val1 = eval(p, op-1, success);
-      if(!*success)
-        return 0;
-      if(val1 == 0)
-        return 0;
-      val2 = eval(op+1, q, success);
-      return (val2 != 0);
-    }
+  int op = find_main_op(p, q); //以主操作符为中心分割表达式
+  if(op == -1) //主运算符查找错误的返回值
+  {
+    printf(ANSI_FMT("Bad expr", ANSI_BG_RED) "\n");
+    return false;
+  }
 
-    if(tokens[op].type == TK_L_OR)//短路算逻辑或
-    {
-      val1 = eval(p, op-1, success);
-      if(!*success)
-        return 0;
-      if(val1 != 0)
-        return 1;
-      val2 = eval(op+1, q, success);
-      return (val2 != 0);
+  int type = tokens[op].type;
+  if(type == TK_NEG || type == TK_UPLUS || type == TK_DREF) // 一元只用右边
+  {
+    int start = nr_code;
+    if (!gen(op + 1, q)) return false;
+    if (type == TK_UPLUS) return true;
+    if (type == TK_NEG) {
+      if (is_imm(start)) { code[start].imm = -code[start].imm; return true; }
+      return emit(OP_NEG, 0);
     }
+    // 常量地址直接读内存
+    if (is_imm(start)) { code[start].op = OP_MEM; return true; }
+    return emit(OP_DREF, 0);
+  }
 
-   
-    
-    val1 = eval(p, op-1, success);
-    val2 = eval(op+1, q, success);
-    
-
-
-    switch (tokens[op].type)
-    {
-      case TK_LE:
-        return ((int32_t)val1 <= (int32_t) val2);
-        break;
-
-      case '+':
-        return val1 + val2;
-        break;
-      case '-':
-        return val1 - val2;
-        break;
-      case '*':
-        return val1 * val2;
-        break;
-      case '/':
-        if(val2 == 0)
-        {
-          printf(ANSI_FMT("Cant devide 0", ANSI_BG_RED) "\n");
-          div_zero_flag = true;
-          *success = false;
-          return 0;
-        }
-        else
-          return (int32_t)val1 / (int32_t)val2;  //一定会舍弃小数
-        break;
-    
-      case TK_EQ:
-        return(val1 == val2) ? 1 : 0;
-      case TK_NEQ:
-        return(val1 == val2) ? 0 : 1;
-
-
-      default:
-        printf(ANSI_FMT("sth wrong", ANSI_BG_RED) "\n");
-        *success = false;
-        return 0;
-        break;
-    }
+  if(type == TK_L_AND || type == TK_L_OR) return gen_logic(p, op, q); //短路
+
+  int bop;
+  switch (type) {
+    case '+': bop = OP_ADD; break;
+    case '-': bop = OP_SUB; break;
+    case '*': bop = OP_MUL; break;
+    case '/': bop = OP_DIV; break;
+    case TK_EQ: bop = OP_EQ; break;
+    case TK_NEQ: bop = OP_NEQ; break;
+    case TK_LE: bop = OP_LE; break;
+    default:
+      printf(ANSI_FMT("sth wrong", ANSI_BG_RED) "\n");
+      return false;
   }
+  int start1 = nr_code;
+  if (!gen(p, op - 1)) return false;
+  int start2 = nr_code;
+  if (!gen(op + 1, q)) return false;
+  // 两边都是常量则直接折叠, 除0留到运行时报错
+  if (start2 - start1 == 1 && code[start1].op == OP_IMM && is_imm(start2) &&
+      !(bop == OP_DIV && code[start2].imm == 0)) {
+    word_t val = alu(bop, code[start1].imm, code[start2].imm);
+    nr_code = start1;
+    depth -= 2;
+    return emit(OP_IMM, val);
+  }
+  return emit(bop, 0);
 }
 
 static void fix_ops(Token *tokens, int nr_token) //一元运算符的处理 解引用和正负
@@ -552,31 +606,116 @@ static void fix_ops(Token *tokens, int nr_token) //一元运算符的处理 解
 
 
 
-word_t expr(char *e, bool *success) //求值主函数
-{ 
-  if (!make_token(e)) 
-  {
-    *success = false;
-    return 0;
+// compile `e' into `code'
+static bool compile(char *e)
+{
+  if (!make_token(e)) return false;
+  fix_ops(tokens, nr_token);//修改运算符类型
+  nr_code = 0;
+  depth = max_depth = 0;
+  return gen(0, nr_token - 1);
+}
+
+// the addresses of the memory read by run(), see expr_run_rec()
+static __thread vaddr_t *rec_addr = NULL;
+static __thread int nr_rec = 0, max_rec = 0;
+
+static inline word_t mem_read(vaddr_t addr)
+{
+  if (rec_addr != NULL) {
+    if (nr_rec < max_rec) rec_addr[nr_rec] = addr;
+    nr_rec ++;
   }
+  return vaddr_read(addr, 4);
+}
 
-  fix_ops(tokens, nr_token);//修改运算符类型
+static word_t run(const ExprInst *inst, int nr_inst, word_t *stack, bool *success)
+{
+  int sp = 0, pc;
+  for (pc = 0; pc < nr_inst; pc ++) {
+    const ExprInst *i = &inst[pc];
+    switch (i->op) {
+      case OP_IMM:  stack[sp ++] = i->imm; break;
+      case OP_REG:  stack[sp ++] = *i->reg; break;
+      case OP_MEM:  stack[sp ++] = mem_read(i->imm); break;
+      case OP_DREF: stack[sp - 1] = mem_read(stack[sp - 1]); break;
+      case OP_NEG:  stack[sp - 1] = -stack[sp - 1]; break;
+      case OP_BOOL: stack[sp - 1] = (stack[sp - 1] != 0); break;
+      case OP_JZ:   if (stack[-- sp] == 0) pc = i->target - 1; break;
+      case OP_JNZ:  if (stack[-- sp] != 0) pc = i->target - 1; break;
+      case OP_JMP:  pc = i->target - 1; break;
+      case OP_DIV:
+        if (stack[sp - 1] == 0) {
+          printf(ANSI_FMT("Cant devide 0", ANSI_BG_RED) "\n");
+          div_zero_flag = true;
+          *success = false;
+          return 0;
+        }
+        // fall through
+      default:
+        sp --;
+        stack[sp - 1] = alu(i->op, stack[sp - 1], stack[sp]);
+        break;
+    }
+  }
+  *success = true;
+  return stack[0];
+}
+
+// compile `e' once, then run it with expr_run(); release it with free()
+ExprCode *expr_compile(char *e, bool *success)
+{
+  *success = compile(e);
+  if (!*success) return NULL;
+  ExprCode *c = malloc(sizeof(ExprCode) + sizeof(ExprInst) * nr_code);
+  assert(c);
+  c->nr_inst = nr_code;
+  c->max_depth = max_depth;
+  memcpy(c->inst, code, sizeof(ExprInst) * nr_code);
+  return c;
+}
 
-  bool eval_success = true; //初始化默认是true
-  uint32_t result = eval(0, nr_token - 1, &eval_success);
+word_t expr_run(ExprCode *c, bool *success)
+{
+  word_t stack[c->max_depth];
+  return run(c->inst, c->nr_inst, stack, success);
+}
 
-  if (eval_success) 
-  {
-    // printf(ANSI_FMT("Expr result is %u", ANSI_FG_GREEN) "\n", result);
-    // printf(ANSI_FMT("Expr result is 0x%08x", ANSI_FG_GREEN) "\n", result);
-    //打印集成在sdb的 cmd_p里面
-    //printf("Expr result is %u\n", result); // 计算成功才打印
-    *success = true;
-    return result; //result是 uint32格式
+// like expr_run(), and also return the addresses of the 4-byte memory
+// read in `addr'; `*nr_addr' can be larger than `max' if there are more
+word_t expr_run_rec(ExprCode *c, bool *success, vaddr_t *addr, int *nr_addr, int max)
+{
+  rec_addr = addr;
+  nr_rec = 0;
+  max_rec = max;
+  word_t ret = expr_run(c, success);
+  rec_addr = NULL;
+  *nr_addr = nr_rec;
+  return ret;
+}
+
+// return the number of registers read by `c', the first `max' are in `reg'
+int expr_regs(ExprCode *c, word_t **reg, int max)
+{
+  int i, j, n = 0;
+  for (i = 0; i < c->nr_inst; i ++) {
+    if (c->inst[i].op != OP_REG) continue;
+    for (j = 0; j < n && j < max; j ++) {
+      if (reg[j] == c->inst[i].reg) break;
+    }
+    if (j < n) continue;
+    if (n < max) reg[n] = c->inst[i].reg;
+    n ++;
   }
-  else 
-  {
+  return n;
+}
+
+word_t expr(char *e, bool *success) //求值主函数
+{
+  if (!compile(e)) {
     *success = false;
     return 0;
   }
+  word_t stack[max_depth];
+  return run(code, nr_code, stack, success);
 }
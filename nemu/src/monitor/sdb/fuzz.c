@@ -0,0 +1,295 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "sdb.h"
+
+/* Differential fuzzer of expr(). tools/gen-expr generates a batch of random
+ * expressions and compiles all of them into one C program, so the reference
+ * values are computed by the host compiler with a single gcc invocation.
+ * Worker threads run gen-expr with different seeds and check the batches
+ * with expr() in-process; the states of expr() are thread-local. Every
+ * mismatch is then shrunk to a smaller expression which still mismatches,
+ * where the reference values of the candidates come from `gen-expr --eval'.
+ */
+
+#define BATCH 20000
+#define MAX_MISMATCH 16
+#define MAX_THREAD 64
+#define MAX_SHRINK_ROUND 200
+#define MAX_TOKEN 1024
+
+void free_regex();
+
+typedef struct {
+  char *e;
+  word_t ref, dut;
+  bool success;
+} Mismatch;
+
+static char gen_path[PATH_MAX];
+static uint64_t nr_expr = 0, nr_job = 0, seed = 0;
+static uint64_t next_job = 0, nr_checked = 0, nr_mismatch = 0;
+static Mismatch mismatch[MAX_MISMATCH];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_mismatch(const char *e, word_t ref, word_t dut, bool success) {
+  pthread_mutex_lock(&lock);
+  if (nr_mismatch < MAX_MISMATCH) {
+    mismatch[nr_mismatch] = (Mismatch) { .e = strdup(e), .ref = ref, .dut = dut, .success = success };
+  }
+  nr_mismatch ++;
+  pthread_mutex_unlock(&lock);
+}
+
+// the lines of gen-expr are "RESULT EXPR"
+static bool parse_line(char *line, word_t *ref, char **e) {
+  line[strcspn(line, "\r\n")] = '\0';
+  char *end;
+  *ref = strtoul(line, &end, 10);
+  if (end == line || *end != ' ') return false;
+  *e = end + 1;
+  return true;
+}
+
+static void *worker(void *arg) {
+  char cmd[PATH_MAX + 64];
+  char *line = NULL;
+  size_t len = 0;
+  while (true) {
+    uint64_t job = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED);
+    if (job >= nr_job) break;
+    uint64_t n = (job == nr_job - 1 ? nr_expr - job * BATCH : BATCH);
+    snprintf(cmd, sizeof(cmd), "%s --batch %" PRIu64 " %" PRIu64, gen_path, n, seed + job);
+    FILE *fp = popen(cmd, "r");
+    if (fp == NULL) break;
+    uint64_t checked = 0;
+    while (getline(&line, &len, fp) != -1) {
+      word_t ref, dut;
+      char *e;
+      bool success;
+      if (!parse_line(line, &ref, &e)) continue;
+      dut = expr(e, &success);
+      if (!success || dut != ref) add_mismatch(e, ref, dut, success);
+      checked ++;
+    }
+    pclose(fp);
+    __atomic_fetch_add(&nr_checked, checked, __ATOMIC_RELAXED);
+  }
+  free(line);
+  free_regex();
+  return NULL;
+}
+
+// ----------- shrinking -----------
+
+typedef struct {
+  char *str[MAX_TOKEN];
+  int nr;
+} TokenList;
+
+static void split(const char *e, TokenList *t) {
+  t->nr = 0;
+  const char *p = e;
+  while (*p != '\0' && t->nr < MAX_TOKEN) {
+    if (*p == ' ') { p ++; continue; }
+    int n = 1;
+    if (isalnum(*p) || *p == '$') {
+      while (isalnum(p[n]) || p[n] == '_') n ++;
+    } else if (strchr("=!<>&|", *p) != NULL && strchr("=&|", p[1]) != NULL && p[1] != '\0') {
+      n = 2;
+    }
+    t->str[t->nr ++] = strndup(p, n);
+    p += n;
+  }
+}
+
+static bool is_term_start(const TokenList *t, int i) {
+  return (isalnum(t->str[i][0]) || t->str[i][0] == '$' || t->str[i][0] == '(');
+}
+
+static bool is_unary(const TokenList *t, int i) {
+  if (strcmp(t->str[i], "-") != 0 && strcmp(t->str[i], "+") != 0 && strcmp(t->str[i], "*") != 0) return false;
+  return (i == 0 || !(isalnum(t->str[i - 1][0]) || t->str[i - 1][0] == ')'));
+}
+
+static int match(const TokenList *t, int i, int dir) {
+  int level = 0;
+  for (; i >= 0 && i < t->nr; i += dir) {
+    if (t->str[i][0] == '(') level ++;
+    else if (t->str[i][0] == ')') level --;
+    if (level == 0) return i;
+  }
+  return -1;
+}
+
+// join the tokens in [0, nr) except [skip_l, skip_r], with `rep' in place of them
+static void join(FILE *fp, const TokenList *t, int skip_l, int skip_r, const char *rep) {
+  int i;
+  bool first = true;
+  for (i = 0; i < t->nr; i ++) {
+    const char *s = t->str[i];
+    if (i >= skip_l && i <= skip_r) {
+      if (i != skip_l || rep == NULL) continue;
+      s = rep;
+    }
+    fprintf(fp, "%s%s", (first ? "" : " "), s);
+    first = false;
+  }
+  fputc('\n', fp);
+}
+
+// candidates which are a little smaller than `e', one per line
+static void gen_candidates(FILE *fp, const TokenList *t) {
+  int i;
+  for (i = 0; i < t->nr; i ++) {
+    const char *s = t->str[i];
+    if (s[0] == '(') {
+      int r = match(t, i, 1);
+      if (r < 0) continue;
+      join(fp, t, i, r, "0");
+      join(fp, t, i, r, "1");
+      // keep the group only
+      TokenList inner = { .nr = r - i - 1 };
+      memcpy(inner.str, &t->str[i + 1], sizeof(char *) * inner.nr);
+      join(fp, &inner, -1, -1, NULL);
+      // drop the parentheses
+      TokenList tmp = *t;
+      memmove(&tmp.str[r], &tmp.str[r + 1], sizeof(char *) * (tmp.nr - r - 1));
+      memmove(&tmp.str[i], &tmp.str[i + 1], sizeof(char *) * (tmp.nr - i - 1));
+      tmp.nr -= 2;
+      join(fp, &tmp, -1, -1, NULL);
+    } else if (isalnum(s[0])) {
+      if (strcmp(s, "0") != 0) join(fp, t, i, i, "0");
+      if (strcmp(s, "1") != 0) join(fp, t, i, i, "1");
+    } else if (is_unary(t, i)) {
+      join(fp, t, i, i, NULL);
+    } else if (s[0] != ')' && i > 0 && i < t->nr - 1) {
+      // a binary operator, keep one of its operands
+      int l = (t->str[i - 1][0] == ')' ? match(t, i - 1, -1) : i - 1);
+      int r = i + 1;
+      while (r < t->nr && is_unary(t, r)) r ++;
+      if (r < t->nr && t->str[r][0] == '(') r = match(t, r, 1);
+      if (l < 0 || r < 0 || r >= t->nr || !is_term_start(t, l)) continue;
+      join(fp, t, i, r, NULL);
+      join(fp, t, l, i, NULL);
+    }
+  }
+}
+
+// shrink `m' in place, return the number of rounds
+static int shrink(Mismatch *m) {
+  char tmp[] = "/tmp/nemu-fuzz-XXXXXX";
+  int fd = mkstemp(tmp);
+  if (fd < 0) return 0;
+  close(fd);
+  char cmd[PATH_MAX * 2 + 64];
+  // a candidate can be rejected by gcc, then the round fails quietly
+  snprintf(cmd, sizeof(cmd), "%s --eval < %s 2> /dev/null", gen_path, tmp);
+
+  int round;
+  char *line = NULL;
+  size_t len = 0;
+  for (round = 0; round < MAX_SHRINK_ROUND; round ++) {
+    TokenList t;
+    split(m->e, &t);
+    FILE *fp = fopen(tmp, "w");
+    gen_candidates(fp, &t);
+    fclose(fp);
+    int i;
+    for (i = 0; i < t.nr; i ++) free(t.str[i]);
+
+    // keep the shortest candidate which still mismatches
+    Mismatch best = { .e = NULL };
+    fp = popen(cmd, "r");
+    while (getline(&line, &len, fp) != -1) {
+      word_t ref, dut;
+      char *e;
+      bool success;
+      if (!parse_line(line, &ref, &e)) continue;
+      dut = expr(e, &success);
+      if ((success && dut == ref) || strlen(e) >= strlen(m->e)) continue;
+      if (best.e != NULL && strlen(e) >= strlen(best.e)) continue;
+      free(best.e);
+      best = (Mismatch) { .e = strdup(e), .ref = ref, .dut = dut, .success = success };
+    }
+    pclose(fp);
+    if (best.e == NULL) break;
+    free(m->e);
+    *m = best;
+  }
+  free(line);
+  unlink(tmp);
+  return round;
+}
+
+// ----------- command -----------
+
+void expr_fuzz(uint64_t n, int nr_thread, uint64_t s) {
+  const char *home = getenv("NEMU_HOME");
+  snprintf(gen_path, sizeof(gen_path), "%s/tools/gen-expr/build/gen-expr", (home ? home : "."));
+  if (access(gen_path, X_OK) != 0) {
+    printf("%s is not found, build it with `make -C $NEMU_HOME/tools/gen-expr'\n", gen_path);
+    return;
+  }
+  if (sizeof(word_t) != 4) {
+    printf("Warning: the reference values are computed in 32 bits, "
+        "but word_t has %d bits\n", (int)sizeof(word_t) * 8);
+  }
+
+  // one thread per host CPU by default
+  if (nr_thread <= 0) nr_thread = sysconf(_SC_NPROCESSORS_ONLN);
+  nr_expr = n;
+  nr_job = (n + BATCH - 1) / BATCH;
+  seed = s;
+  next_job = nr_checked = nr_mismatch = 0;
+  if (nr_thread > nr_job) nr_thread = nr_job;
+  if (nr_thread > MAX_THREAD) nr_thread = MAX_THREAD;
+  printf("Checking %" PRIu64 " expressions with %d threads, seed = %" PRIu64 "\n", n, nr_thread, s);
+
+  pthread_t tid[MAX_THREAD];
+  uint64_t start = get_time();
+  int i;
+  for (i = 0; i < nr_thread; i ++) {
+    int ret = pthread_create(&tid[i], NULL, worker, NULL);
+    Assert(ret == 0, "Can not create the fuzzer threads");
+  }
+  for (i = 0; i < nr_thread; i ++) pthread_join(tid[i], NULL);
+  uint64_t us = get_time() - start;
+
+  // gen-expr skips the expressions which trap, e.g. division by zero
+  printf("%" PRIu64 " checked, %" PRIu64 " mismatches, %.1fs, %.0f expressions/s\n",
+      nr_checked, nr_mismatch, us / 1e6, (us == 0 ? 0 : nr_checked * 1e6 / us));
+
+  int nr = (nr_mismatch < MAX_MISMATCH ? nr_mismatch : MAX_MISMATCH), j;
+  for (i = 0; i < nr; i ++) {
+    Mismatch *m = &mismatch[i];
+    printf("[%d] %s\n", i, m->e);
+    int round = shrink(m);
+    for (j = 0; j < i; j ++) {
+      if (strcmp(mismatch[j].e, m->e) == 0) break;
+    }
+    if (j < i) { printf("    shrunk to the same expression as [%d]\n", j); continue; }
+    printf("    shrunk in %d rounds: %s\n", round, m->e);
+    printf("    expected " FMT_WORD ", got ", m->ref);
+    if (m->success) printf(FMT_WORD "\n", m->dut);
+    else printf("an error\n");
+  }
+  for (i = 0; i < nr; i ++) free(mismatch[i].e);
+}
@@ -0,0 +1,111 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+/* Machine readable results of a run for --json. The file is written once
+ * at exit, or when an assertion fails. `dump' in a script adds the
+ * registers at that time to "dumps".
+ */
+
+extern uint64_t g_nr_guest_inst;
+extern uint64_t g_timer;
+
+static const char *json_file = NULL;
+static FILE *dumps = NULL;
+static char *dump_buf = NULL;
+static size_t dump_size = 0;
+static int nr_dump = 0;
+static bool written = false;
+
+static void json_str(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; *s; s ++) {
+    if (*s == '"' || *s == '\\') fprintf(fp, "\\%c", *s);
+    else if ((uint8_t)*s < 0x20) fprintf(fp, "\\u%04x", *s);
+    else fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void json_regs(FILE *fp) {
+  fprintf(fp, "\"pc\": %" PRIu64 ", \"regs\": {", (uint64_t)cpu.pc);
+  const char *name;
+  int i;
+  for (i = 0; (name = isa_reg_name(i)) != NULL; i ++) {
+    fprintf(fp, "%s", (i == 0 ? "" : ", "));
+    json_str(fp, name);
+    fprintf(fp, ": %" PRIu64, (uint64_t)*isa_reg_str2ptr(name));
+  }
+  fprintf(fp, "}");
+}
+
+void json_dump(const char *label) {
+  if (dumps == NULL) {
+    printf("dump is only recorded with --json\n");
+    return;
+  }
+  fprintf(dumps, "%s\n    {\"label\": ", (nr_dump == 0 ? "" : ","));
+  json_str(dumps, label);
+  fprintf(dumps, ", \"inst\": %" PRIu64 ", ", g_nr_guest_inst);
+  json_regs(dumps);
+  fprintf(dumps, "}");
+  nr_dump ++;
+}
+
+static const char *state_name(bool is_assert) {
+  if (is_assert) return "assert";
+  switch (nemu_state.state) {
+    case NEMU_RUNNING: return "running";
+    case NEMU_STOP: return "stop";
+    case NEMU_END: return "end";
+    case NEMU_ABORT: return "abort";
+    case NEMU_QUIT: return "quit";
+    default: return "unknown";
+  }
+}
+
+void json_report(bool is_assert) {
+  if (json_file == NULL || written) return;
+  written = true;
+  FILE *fp = fopen(json_file, "w");
+  if (fp == NULL) {
+    Log("Can not open '%s', the results are not written", json_file);
+    return;
+  }
+  fflush(dumps);
+  bool good = (nemu_state.state == NEMU_END && nemu_state.halt_ret == 0) ||
+    (nemu_state.state == NEMU_QUIT && !is_assert);
+  // `q' after the end of the program changes the state to NEMU_QUIT, but halt_pc is kept
+  const char *trap = (nemu_state.halt_pc == 0 ? "none" : nemu_state.halt_ret == 0 ? "good" : "bad");
+  fprintf(fp, "{\n  \"state\": \"%s\",\n  \"good\": %s,\n  \"trap\": \"%s\",\n",
+      state_name(is_assert), (good ? "true" : "false"), trap);
+  fprintf(fp, "  \"halt_pc\": %" PRIu64 ",\n  \"halt_ret\": %" PRIu64 ",\n",
+      (uint64_t)nemu_state.halt_pc, (uint64_t)nemu_state.halt_ret);
+  fprintf(fp, "  \"inst\": %" PRIu64 ",\n  \"host_time_us\": %" PRIu64 ",\n  \"inst_per_sec\": %" PRIu64 ",\n  ",
+      g_nr_guest_inst, g_timer, (g_timer > 0 ? g_nr_guest_inst * 1000000 / g_timer : 0));
+  json_regs(fp);
+  fprintf(fp, ",\n  \"dumps\": [%s\n  ]\n}\n", dump_buf);
+  fclose(fp);
+}
+
+static void json_exit() { json_report(false); }
+
+void json_init(const char *file) {
+  json_file = file;
+  dumps = open_memstream(&dump_buf, &dump_size);
+  assert(dumps);
+  atexit(json_exit);
+}
@@ -0,0 +1,230 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "sdb.h"
+
+/* Searching and comparing the whole pmem. They work on the host memory
+ * of pmem directly, 16 bytes at a time with SSE2, so that scanning
+ * hundreds of MB takes tens of milliseconds.
+ */
+
+#define NR_SHOW 20
+#define MERGE_GAP 16
+
+static uint8_t *pmem_base() { return guest_to_host(CONFIG_MBASE); }
+
+typedef struct {
+  uint64_t nr;
+} Found;
+
+static void found(Found *f, size_t off) {
+  if (f->nr < NR_SHOW) printf("  " FMT_PADDR "\n", (paddr_t)(CONFIG_MBASE + off));
+  f->nr ++;
+}
+
+// 32-bit value at aligned addresses
+static void find_word(uint32_t val, Found *f) {
+  uint32_t *p = (uint32_t *)pmem_base();
+  size_t n = CONFIG_MSIZE / 4, i = 0;
+#ifdef __SSE2__
+  __m128i v = _mm_set1_epi32(val);
+  for (; i + 16 <= n; i += 16) {
+    __m128i c0 = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(p + i)), v);
+    __m128i c1 = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(p + i + 4)), v);
+    __m128i c2 = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(p + i + 8)), v);
+    __m128i c3 = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(p + i + 12)), v);
+    __m128i any = _mm_or_si128(_mm_or_si128(c0, c1), _mm_or_si128(c2, c3));
+    if (likely(_mm_movemask_epi8(any) == 0)) continue;
+    for (size_t j = i; j < i + 16; j ++) {
+      if (p[j] == val) found(f, j * 4);
+    }
+  }
+#endif
+  for (size_t off = i * 4; off < CONFIG_MSIZE; off += 4) {
+    if (p[off / 4] == val) found(f, off);
+  }
+}
+
+// byte string at any address
+static void find_bytes(const uint8_t *pat, size_t len, Found *f) {
+  uint8_t *p = pmem_base();
+  size_t size = CONFIG_MSIZE, i = 0;
+  if (len > size) return;
+#ifdef __SSE2__
+  // compare the first and the last bytes of 16 positions at once,
+  // and only check the others for the positions where both match
+  __m128i first = _mm_set1_epi8(pat[0]), last = _mm_set1_epi8(pat[len - 1]);
+  for (; i + len - 1 + 16 <= size; i += 16) {
+    __m128i eq = _mm_and_si128(
+        _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(p + i)), first),
+        _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(p + i + len - 1)), last));
+    uint32_t mask = _mm_movemask_epi8(eq);
+    while (unlikely(mask != 0)) {
+      int k = __builtin_ctz(mask);
+      mask &= mask - 1;
+      if (len <= 2 || memcmp(p + i + k + 1, pat + 1, len - 2) == 0) found(f, i + k);
+    }
+  }
+#endif
+  for (; i + len <= size; i ++) {
+    if (memcmp(p + i, pat, len) == 0) found(f, i);
+  }
+}
+
+static int hex_val(int c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// find EXPR | find "STRING" | find x:HEXBYTES
+void mem_find(char *args) {
+  while (*args == ' ') args ++;
+  uint8_t pat[256];
+  size_t len = 0;
+  bool is_word = false;
+  uint32_t val = 0;
+  if (args[0] == '"') {
+    char *end = strrchr(args + 1, '"');
+    if (end == NULL || end == args + 1 || end - args - 1 > sizeof(pat)) {
+      printf("Invalid string %s\n", args);
+      return;
+    }
+    len = end - args - 1;
+    memcpy(pat, args + 1, len);
+  } else if (strncmp(args, "x:", 2) == 0) {
+    char *s = args + 2;
+    while (hex_val(s[0]) >= 0 && hex_val(s[1]) >= 0 && len < sizeof(pat)) {
+      pat[len ++] = hex_val(s[0]) * 16 + hex_val(s[1]);
+      s += 2;
+    }
+    if (len == 0 || *s != '\0') {
+      printf("Invalid byte pattern %s\n", args);
+      return;
+    }
+  } else {
+    bool success;
+    val = expr(args, &success);
+    if (!success) {
+      printf("Invalid expression '%s'\n", args);
+      return;
+    }
+    is_word = true;
+  }
+
+  Found f = {};
+  uint64_t start = get_time();
+  if (is_word) find_word(val, &f);
+  else find_bytes(pat, len, &f);
+  uint64_t us = get_time() - start;
+  if (f.nr > NR_SHOW) printf("  ...\n");
+  printf("%" PRIu64 " matches in %d MB of pmem, %" PRIu64 " ms\n", f.nr, CONFIG_MSIZE >> 20, us / 1000);
+}
+
+void mem_save(const char *file) {
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return;
+  }
+  size_t ret = fwrite(pmem_base(), 1, CONFIG_MSIZE, fp);
+  fclose(fp);
+  if (ret != CONFIG_MSIZE) printf("Failed to write '%s'\n", file);
+  else printf("pmem is saved to %s\n", file);
+}
+
+// the first byte in [i, end) which differs, or end
+static size_t diff_first(const uint8_t *a, const uint8_t *b, size_t i, size_t end) {
+#ifdef __SSE2__
+  for (; i + 16 <= end; i += 16) {
+    __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(a + i)), _mm_loadu_si128((__m128i *)(b + i)));
+    uint32_t mask = _mm_movemask_epi8(eq) ^ 0xffff;
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < end && a[i] == b[i]; i ++);
+  return i;
+}
+
+// the first byte in [i, end) which is the same, or end
+static size_t same_first(const uint8_t *a, const uint8_t *b, size_t i, size_t end) {
+  for (; i < end && a[i] != b[i]; i ++);
+  return i;
+}
+
+void mem_diff(const char *file) {
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    printf("Can not open '%s'\n", file);
+    if (fd >= 0) close(fd);
+    return;
+  }
+  size_t size = st.st_size;
+  if (size != CONFIG_MSIZE) {
+    printf("The size of '%s' is %zu, but pmem is %d bytes, only the common part is compared\n",
+        file, size, CONFIG_MSIZE);
+    if (size > CONFIG_MSIZE) size = CONFIG_MSIZE;
+  }
+  uint8_t *snap = (size == 0 ? NULL : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0));
+  close(fd);
+  if (snap == MAP_FAILED) {
+    printf("Can not map '%s'\n", file);
+    return;
+  }
+
+  uint8_t *p = pmem_base();
+  uint64_t start = get_time();
+  uint64_t nr_range = 0, nr_byte = 0;
+  size_t i = 0;
+  while (i < size) {
+    // skip identical pages quickly
+    size_t page_end = (i | 4095) + 1;
+    if (page_end > size) page_end = size;
+    if (memcmp(p + i, snap + i, page_end - i) == 0) { i = page_end; continue; }
+    size_t lo = diff_first(p, snap, i, page_end);
+    if (lo == page_end) { i = page_end; continue; }
+    size_t hi = same_first(p, snap, lo, size), n = hi - lo;
+    // ranges closer than MERGE_GAP bytes are shown as one
+    while (hi < size) {
+      size_t gap_end = (hi + MERGE_GAP < size ? hi + MERGE_GAP : size);
+      size_t next = diff_first(p, snap, hi, gap_end);
+      if (next == gap_end) break;
+      hi = same_first(p, snap, next, size);
+      n += hi - next;
+    }
+    if (nr_range < NR_SHOW) {
+      printf("  [" FMT_PADDR ", " FMT_PADDR ")  %zu bytes differ\n", (paddr_t)(CONFIG_MBASE + lo),
+          (paddr_t)(CONFIG_MBASE + hi), n);
+    }
+    nr_range ++;
+    nr_byte += n;
+    i = hi;
+  }
+  uint64_t us = get_time() - start;
+  if (nr_range > NR_SHOW) printf("  ...\n");
+  printf("%" PRIu64 " bytes differ in %" PRIu64 " ranges, %" PRIu64 " ms\n", nr_byte, nr_range, us / 1000);
+  if (snap != NULL) munmap(snap, size);
+}
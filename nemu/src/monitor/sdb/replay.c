@@ -0,0 +1,296 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <device/mmio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* Reverse execution. A checkpoint of `cpu' is taken every
+ * CONFIG_REPLAY_INTERVAL instructions, and the first write to a pmem page
+ * after a checkpoint saves the old content of the page into it, so pmem can
+ * be rolled back to any checkpoint kept. MMIO reads are the only input from
+ * the outside (timers and keys are read through MMIO), so they are logged,
+ * and going back to an instruction means rolling back to the checkpoint
+ * before it and replaying forward with the logged values. During replay,
+ * MMIO writes are dropped since the devices have already seen them.
+ * Only the accesses made by instructions are logged, and the ones made by
+ * the debugger (e.g. `x' and watchpoints) go to the devices directly.
+ * Only the latest CONFIG_REPLAY_NR_CKPT checkpoints are kept.
+ *
+ * Besides `cpu' and pmem, the counters of inststat are rolled back. The
+ * profiles of ftrace, pcsample and timeline are not, so the instructions
+ * replayed are counted again, and the call stack of ftrace is not the one
+ * at the checkpoint.
+ */
+
+extern uint64_t g_nr_guest_inst;
+void wp_refresh();
+uint64_t *inststat_save();
+void inststat_restore(const uint64_t *buf);
+
+typedef struct Page {
+  uint32_t idx;
+  struct Page *next;
+  uint8_t data[PAGE_SIZE];
+} Page;
+
+typedef struct {
+  uint64_t inst;      // g_nr_guest_inst when it is taken
+  uint32_t seq;
+  CPU_state cpu;
+  uint64_t log_pos;   // the first MMIO read after it
+  Page *page;         // pages written after it, with their old content
+  uint64_t nr_page;
+  IFDEF(CONFIG_INSTSTAT, uint64_t *inststat);
+} Checkpoint;
+
+typedef struct {
+  uint64_t inst;
+  word_t data;
+} MMIORecord;
+
+// the checkpoint which saved each page last, checked by pmem_write()
+uint32_t *replay_page_seq = NULL;
+uint32_t replay_seq = 0;
+
+static Checkpoint ckpt[CONFIG_REPLAY_NR_CKPT];
+static int nr_ckpt = 0;
+static uint32_t next_seq = 1;
+static uint64_t next_ckpt_inst = 0;
+
+static MMIORecord *mmio_log = NULL;
+static uint64_t log_base = 0;   // index of mmio_log[0]
+static uint64_t log_end = 0;
+static uint64_t log_pos = 0;    // the next MMIO read
+static uint64_t replay_end = 0; // instructions before it are replayed
+
+// ----------- checkpoints -----------
+
+static void free_pages(Checkpoint *c) {
+  Page *p, *next;
+  for (p = c->page; p != NULL; p = next) {
+    next = p->next;
+    free(p);
+  }
+  c->page = NULL;
+  c->nr_page = 0;
+}
+
+// drop the oldest checkpoint, and the MMIO reads before the new oldest one
+static void drop_oldest() {
+  free_pages(&ckpt[0]);
+  IFDEF(CONFIG_INSTSTAT, free(ckpt[0].inststat));
+  memmove(ckpt, ckpt + 1, sizeof(ckpt[0]) * (-- nr_ckpt));
+  uint64_t n = ckpt[0].log_pos - log_base;
+  if (n == 0 || mmio_log == NULL) return;
+  memmove(mmio_log, mmio_log + n, sizeof(mmio_log[0]) * (log_end - ckpt[0].log_pos));
+  log_base += n;
+}
+
+static void take_checkpoint() {
+  if (nr_ckpt == CONFIG_REPLAY_NR_CKPT) drop_oldest();
+  Checkpoint *c = &ckpt[nr_ckpt ++];
+  *c = (Checkpoint) { .inst = g_nr_guest_inst, .seq = next_seq ++, .cpu = cpu, .log_pos = log_pos };
+  IFDEF(CONFIG_INSTSTAT, c->inststat = inststat_save());
+  replay_seq = c->seq;
+  next_ckpt_inst = g_nr_guest_inst + CONFIG_REPLAY_INTERVAL;
+}
+
+void replay_save_page(uint32_t idx) {
+  Checkpoint *c = &ckpt[nr_ckpt - 1];
+  Page *p = malloc(sizeof(Page));
+  assert(p);
+  p->idx = idx;
+  memcpy(p->data, guest_to_host(CONFIG_MBASE + ((paddr_t)idx << PAGE_SHIFT)), PAGE_SIZE);
+  p->next = c->page;
+  c->page = p;
+  c->nr_page ++;
+  replay_page_seq[idx] = c->seq;
+}
+
+// roll back to checkpoint k, and drop the ones after it
+static void restore(int k) {
+  if (g_nr_guest_inst > replay_end) replay_end = g_nr_guest_inst;
+  int i;
+  for (i = nr_ckpt - 1; i >= k; i --) {
+    Page *p;
+    for (p = ckpt[i].page; p != NULL; p = p->next) {
+      memcpy(guest_to_host(CONFIG_MBASE + ((paddr_t)p->idx << PAGE_SHIFT)), p->data, PAGE_SIZE);
+      replay_page_seq[p->idx] = 0;
+    }
+    free_pages(&ckpt[i]);
+    IFDEF(CONFIG_INSTSTAT, if (i > k) free(ckpt[i].inststat));
+  }
+  nr_ckpt = k + 1;
+  Checkpoint *c = &ckpt[k];
+  cpu = c->cpu;
+  g_nr_guest_inst = c->inst;
+  log_pos = c->log_pos;
+  replay_seq = c->seq;
+  next_ckpt_inst = c->inst + CONFIG_REPLAY_INTERVAL;
+  IFDEF(CONFIG_INSTSTAT, inststat_restore(c->inststat));
+  nemu_state.state = NEMU_STOP;
+  wp_refresh();
+}
+
+// called before a batch of instructions, return the length of the batch
+uint64_t replay_update(uint64_t n) {
+  if (g_nr_guest_inst >= next_ckpt_inst) take_checkpoint();
+  uint64_t left = next_ckpt_inst - g_nr_guest_inst;
+  return (n < left ? n : left);
+}
+
+// ----------- MMIO -----------
+
+#ifdef CONFIG_DEVICE
+static uint64_t log_max = 0;
+
+word_t replay_mmio_read(paddr_t addr, int len) {
+  if (!g_exec_inst) return mmio_read(addr, len);
+  if (g_nr_guest_inst < replay_end) {
+    MMIORecord *r = &mmio_log[log_pos - log_base];
+    Assert(log_pos < log_end && r->inst == g_nr_guest_inst,
+        "Replay diverges at pc = " FMT_WORD ", instruction %" PRIu64, cpu.pc, g_nr_guest_inst);
+    log_pos ++;
+    return r->data;
+  }
+  word_t data = mmio_read(addr, len);
+  if (log_end - log_base == log_max) {
+    log_max = (log_max == 0 ? 4096 : log_max * 2);
+    mmio_log = realloc(mmio_log, sizeof(mmio_log[0]) * log_max);
+    assert(mmio_log);
+  }
+  // reads after the replayed ones overwrite the old future
+  log_end = log_pos;
+  mmio_log[log_end - log_base] = (MMIORecord) { .inst = g_nr_guest_inst, .data = data };
+  log_pos = ++ log_end;
+  return data;
+}
+
+void replay_mmio_write(paddr_t addr, int len, word_t data) {
+  if (g_exec_inst && g_nr_guest_inst < replay_end) return;
+  mmio_write(addr, len, data);
+}
+#endif
+
+// ----------- reverse execution -----------
+
+static int saved_stdout = -1;
+
+// the messages of breakpoints and watchpoints are not shown while searching
+static void quiet(bool on) {
+  fflush(stdout);
+  if (on) {
+    saved_stdout = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+  } else {
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+  }
+}
+
+static bool ended() {
+  return nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT ||
+    nemu_state.state == NEMU_QUIT;
+}
+
+// run to the given instruction, return the last stop by breakpoints or watchpoints before it
+static uint64_t run_to(uint64_t target) {
+  uint64_t last_stop = 0;
+  while (g_nr_guest_inst < target && !ended()) {
+    cpu_exec(target - g_nr_guest_inst);
+    if (g_nr_guest_inst < target && nemu_state.state == NEMU_STOP) last_stop = g_nr_guest_inst;
+  }
+  return last_stop;
+}
+
+static int find_checkpoint(uint64_t inst) {
+  int k;
+  for (k = nr_ckpt - 1; k > 0 && ckpt[k].inst > inst; k --);
+  return k;
+}
+
+static void report() {
+  printf("Now at instruction %" PRIu64 ", pc = " FMT_WORD "\n", g_nr_guest_inst, cpu.pc);
+}
+
+// go back n instructions, return false if the beginning of the record is reached
+bool replay_step_back(uint64_t n) {
+  if (nr_ckpt == 0) { printf("Nothing is recorded\n"); return false; }
+  uint64_t target = (g_nr_guest_inst > n ? g_nr_guest_inst - n : 0);
+  bool ok = (target >= ckpt[0].inst && g_nr_guest_inst > ckpt[0].inst);
+  if (target < ckpt[0].inst) {
+    printf("Only instructions after %" PRIu64 " are kept\n", ckpt[0].inst);
+    target = ckpt[0].inst;
+  }
+  restore(find_checkpoint(target));
+  quiet(true);
+  run_to(target);
+  quiet(false);
+  nemu_state.state = NEMU_STOP;
+  report();
+  return ok;
+}
+
+// go back to the last stop by breakpoints or watchpoints, return false if there is none
+bool replay_continue_back() {
+  if (nr_ckpt == 0) { printf("Nothing is recorded\n"); return false; }
+  uint64_t now = g_nr_guest_inst, end = now;
+  uint64_t hit = 0;
+  int k = find_checkpoint(now == 0 ? 0 : now - 1);
+  quiet(true);
+  for (; k >= 0; k --) {
+    uint64_t start = ckpt[k].inst;
+    restore(k);
+    hit = run_to(end);
+    if (hit > start) {
+      restore(k);
+      run_to(hit);
+      break;
+    }
+    // a stop just at the start of the later segment is found by this one
+    end = (start + 1 < now ? start + 1 : now);
+    if (k == 0) restore(0);
+  }
+  quiet(false);
+  nemu_state.state = NEMU_STOP;
+  if (hit == 0) printf("No breakpoint or watchpoint is hit after instruction %" PRIu64 "\n", ckpt[0].inst);
+  report();
+  return hit != 0;
+}
+
+void replay_display() {
+  uint64_t nr_page = 0;
+  int i;
+  for (i = 0; i < nr_ckpt; i ++) nr_page += ckpt[i].nr_page;
+  printf("%d checkpoints from instruction %" PRIu64 " to %" PRIu64 ", every %d instructions\n",
+      nr_ckpt, (nr_ckpt ? ckpt[0].inst : 0), (nr_ckpt ? ckpt[nr_ckpt - 1].inst : 0), CONFIG_REPLAY_INTERVAL);
+  printf("%" PRIu64 " saved pages (%" PRIu64 " KB), %" PRIu64 " MMIO reads logged\n",
+      nr_page, nr_page * PAGE_SIZE / 1024, log_end - log_base);
+  if (g_nr_guest_inst < replay_end) {
+    printf("Replaying, recorded until instruction %" PRIu64 "\n", replay_end);
+  }
+}
+
+void init_replay() {
+  replay_page_seq = calloc(CONFIG_MSIZE >> PAGE_SHIFT, sizeof(replay_page_seq[0]));
+  assert(replay_page_seq);
+}
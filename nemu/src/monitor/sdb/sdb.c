@@ -21,9 +21,10 @@
 
 #include "watchpoint.h"
 #include <memory/vaddr.h>//adding .h
+#include <memory/paddr.h>
 
 
-extern bool div_zero_flag ;//除0标志
+extern __thread bool div_zero_flag ;//除0标志
 
 
 static int is_batch_mode = false;
@@ -86,9 +87,20 @@ static int cmd_info(char *args);//寄存器或监视点信息
 static int cmd_x(char *args);//查看内存地址
 static int cmd_p(char *agrs);//表达式求值
 static int cmd_t_expr(char *args);//测试表达式
+static int cmd_fuzz(char *args);//并行差分测试表达式求值
 
 static int cmd_w(char *args);//添加监视点
 static int cmd_d(char *args);//删除监视点
+static int cmd_find(char *args);//搜索内存
+static int cmd_msave(char *args);//保存内存快照
+static int cmd_mdiff(char *args);//与快照比较
+IFDEF(CONFIG_TRACE, static int cmd_trace(char *args));//控制指令trace
+IFDEF(CONFIG_BREAKPOINT, static int cmd_b(char *args));//添加断点
+IFDEF(CONFIG_BREAKPOINT, static int cmd_bd(char *args));//删除断点
+IFDEF(CONFIG_REPLAY, static int cmd_rsi(char *args));//反向单步
+IFDEF(CONFIG_BREAKPOINT, static int cmd_until(char *args));//运行到指定地址
+static int cmd_dump(char *args);//记录寄存器到 JSON
+IFDEF(CONFIG_REPLAY, static int cmd_rc(char *args));//反向继续
 
 
 // 命令表结构体：存储命令名、描述和处理函数
@@ -103,7 +115,7 @@ static struct {
   //si[N]
   { "si","Let program step through N insts and then pause execution", cmd_si},
   //usage si 10 就是单步执行10次
-  { "info","Type r to print all regs ; w to print all watchpoints",cmd_info},
+  { "info","Type r to print all regs ; w to print all watchpoints ; b to print all breakpoints",cmd_info},
   //usage ： info r 就是打印所有寄存器 info w打印监视点还没实现
 
   { "x","x to examine memory", cmd_x},
@@ -112,9 +124,26 @@ static struct {
   { "p", "Print expression ", cmd_p},
 
   {"t_expr", "Tests 1000 generated expr", cmd_t_expr},
+  {"fuzz", "fuzz N [THREADS] [SEED] to check expr() with N expressions from tools/gen-expr", cmd_fuzz},
   
   {"w", "Add WatchPoint", cmd_w},
   {"d", "Delete WatchPoint", cmd_d},
+  {"find", "find EXPR | \"STRING\" | x:HEXBYTES to search pmem for an aligned 32-bit value or bytes", cmd_find},
+  {"dump", "dump [LABEL] to record the registers in the JSON output of --json", cmd_dump},
+  {"msave", "msave FILE to save pmem as a snapshot", cmd_msave},
+  {"mdiff", "mdiff FILE to show the ranges of pmem different from a snapshot", cmd_mdiff},
+#ifdef CONFIG_BREAKPOINT
+  {"b", "b <addr|symbol> [if cond] to add a breakpoint", cmd_b},
+  {"bd", "Delete breakpoint", cmd_bd},
+  {"until", "until <addr|symbol> to continue until reaching the address", cmd_until},
+#endif
+#ifdef CONFIG_REPLAY
+  {"rsi", "rsi [N] to step back N insts", cmd_rsi},
+  {"rc", "Continue backwards to the last breakpoint or watchpoint hit", cmd_rc},
+#endif
+#ifdef CONFIG_TRACE
+  {"trace", "trace [on|off|inst START [END]|pc LO HI|func NAME|all] to control the trace window", cmd_trace},
+#endif
 
 
   /* TODO: Add more commands */
@@ -172,6 +201,31 @@ static int cmd_si(char *args)
   return 0;
 }
 
+#ifdef CONFIG_REPLAY
+static int cmd_rsi(char *args)
+{
+  char *arg = strtok(NULL, " ");
+  long num = 1;
+  if (arg != NULL) {
+    char *endptr;
+    num = strtol(arg, &endptr, 10);
+    if (*endptr != '\0' || num <= 0)
+    {
+      printf(ANSI_FMT("Input is not a positive number", ANSI_BG_RED) "\n");
+      return 0;
+    }
+  }
+  replay_step_back(num);
+  return 0;
+}
+
+static int cmd_rc(char *args)
+{
+  replay_continue_back();
+  return 0;
+}
+#endif
+
 
 // static int cmd_si(char *args) {
 //   char *num_str = strtok(NULL, " ");
@@ -201,9 +255,22 @@ static int cmd_info(char *args)
     print_watchpoints();
 
   }
+#ifdef CONFIG_BREAKPOINT
+  else if(arg != NULL && strcmp(arg, "b") == 0)
+  {
+    bp_display();
+  }
+#endif
+#ifdef CONFIG_REPLAY
+  else if(arg != NULL && strcmp(arg, "rr") == 0)
+  {
+    replay_display();
+  }
+#endif
   else
   {
-    printf("Usage: info r | info w\n");
+    printf("Usage: info r | info w%s%s\n", MUXDEF(CONFIG_BREAKPOINT, " | info b", ""),
+        MUXDEF(CONFIG_REPLAY, " | info rr", ""));
   }
 
   return 0;
@@ -239,6 +306,50 @@ static int cmd_x(char *args)//打印内存
 
 }
 
+static int cmd_dump(char *args)
+{
+  json_dump(args == NULL ? "" : args);
+  return 0;
+}
+
+static int cmd_fuzz(char *args)
+{
+  char *n = strtok(NULL, " ");
+  char *thread = strtok(NULL, " ");
+  char *seed = strtok(NULL, " ");
+  if (n == NULL) { printf("Usage: fuzz N [THREADS] [SEED]\n"); return 0; }
+  expr_fuzz(strtoull(n, NULL, 0), (thread ? atoi(thread) : 0),
+      (seed ? strtoull(seed, NULL, 0) : time(NULL)));
+  return 0;
+}
+
+static int cmd_find(char *args)
+{
+  if (args == NULL)
+  {
+    printf("Usage: find EXPR | find \"STRING\" | find x:HEXBYTES\n");
+    return 0;
+  }
+  mem_find(args);
+  return 0;
+}
+
+static int cmd_msave(char *args)
+{
+  char *file = strtok(NULL, " ");
+  if (file == NULL) { printf("Usage: msave FILE\n"); return 0; }
+  mem_save(file);
+  return 0;
+}
+
+static int cmd_mdiff(char *args)
+{
+  char *file = strtok(NULL, " ");
+  if (file == NULL) { printf("Usage: mdiff FILE\n"); return 0; }
+  mem_diff(file);
+  return 0;
+}
+
 // void print_tokens(char *e); //打印token的函数
 
 // static int cmd_p(char *args)
@@ -356,13 +467,14 @@ static int cmd_w(char *args)
 
   wp_expr = args;
 
-  int result = expr(wp_expr, &success);//得到结果
+  ExprCode *code = expr_compile(wp_expr, &success);//只编译一次
   if(success == true)
   {
-    WP *wp = new_wp(wp_expr, result);
+    WP *wp = new_wp(wp_expr, code);//求值并记录读到的寄存器和内存
     if (wp) {
-      printf("Watchpoint %d set: %s = 0x%08x\n", wp->NO, wp_expr, (uint32_t)result);
+      printf("Watchpoint %d set: %s = 0x%08x\n", wp->NO, wp_expr, (uint32_t)wp->old_val);
     }
+    else free(code);
   }
 
 
@@ -393,6 +505,95 @@ static int cmd_d(char *args)
 
 
 
+#ifdef CONFIG_BREAKPOINT
+static int cmd_b(char *args)
+{
+  if (args == NULL || *args == '\0')
+  {
+    printf("Usage: b <addr|symbol> [if cond]\n");
+    return 0;
+  }
+  char *cond = strstr(args, " if ");
+  if (cond != NULL)
+  {
+    *cond = '\0';
+    cond += 4;
+  }
+  while (*args == ' ') args ++;
+  char *end = args + strlen(args);
+  while (end > args && end[-1] == ' ') *(-- end) = '\0';
+
+  // 先查符号, 否则作为表达式求值
+  vaddr_t addr;
+  if (!elf_func_lookup(args, &addr))
+  {
+    bool success;
+    addr = expr(args, &success);
+    if (!success)
+    {
+      printf("Invalid address '%s'\n", args);
+      return 0;
+    }
+  }
+  int no = bp_add(addr, cond);
+  if (no > 0) printf("Breakpoint %d at " FMT_WORD "\n", no, addr);
+  return 0;
+}
+
+// 临时断点, 到达后删除
+static int cmd_until(char *args)
+{
+  if (args == NULL)
+  {
+    printf("Usage: until <addr|symbol>\n");
+    return 0;
+  }
+  vaddr_t addr;
+  if (!elf_func_lookup(args, &addr))
+  {
+    bool success;
+    addr = expr(args, &success);
+    if (!success)
+    {
+      printf("Invalid address '%s'\n", args);
+      return 0;
+    }
+  }
+  // 已有无条件断点时 bp_add 失败, 仍然可以运行; 其他失败时不运行
+  int no = bp_add(addr, NULL);
+  if (no < 0 && !bp_at(addr)) return 0;
+  cpu_exec(-1);
+  if (no > 0) bp_del(no);
+  return 0;
+}
+
+static int cmd_bd(char *args)
+{
+  char *arg = strtok(NULL, " ");
+  char *endptr;
+  int no = (arg == NULL ? -1 : strtol(arg, &endptr, 10));
+  if (arg == NULL || *endptr != '\0' || no <= 0)
+  {
+    printf("Usage: bd <NO>\n");
+    return 0;
+  }
+  if (bp_del(no)) printf("Deleted breakpoint %d\n", no);
+  else printf("Breakpoint %d not found\n", no);
+  return 0;
+}
+#endif
+
+#ifdef CONFIG_TRACE
+static int cmd_trace(char *args)
+{
+  bool itrace_config(const char *args);
+  if (!itrace_config(args)) {
+    printf("Usage: trace [on|off|inst START [END]|pc LO HI|func NAME|all]\n");
+  }
+  return 0;
+}
+#endif
+
 
 // 设置批处理模式
 void sdb_set_batch_mode() 
@@ -400,15 +601,99 @@ void sdb_set_batch_mode()
   is_batch_mode = true;
 }
 
+// 从文件执行命令, 代替交互输入
+static const char *script_file = NULL;
+void sdb_set_script(const char *file)
+{
+  script_file = file;
+}
+
+#ifdef CONFIG_GDBSTUB
+static const char *gdb_addr = NULL;
+void gdb_mainloop(const char *addr);
+
+void sdb_set_gdb(const char *addr) {
+  gdb_addr = addr;
+}
+#endif
+
+
 
 
 
 
 
+// 执行一行命令, 返回 -1 表示退出
+static int sdb_exec(char *str)
+{
+  char *str_end = str + strlen(str); // 输入字符串末尾  str代表开头
+
+  /* extract the first token as the command */
+  char *cmd = strtok(str, " "); //以空格分割得到第一个token
+  if (cmd == NULL) { return 0; } // 空输入，跳过
+
+  /* treat the remaining string as the arguments,
+   * which may need further parsing
+   */
+  char *args = cmd + strlen(cmd) + 1; //得到第一个命令后args继续向后移动 得到命令的参数
+  if (args >= str_end)  //边界检查 如果越界就给null
+  {
+    args = NULL;
+  }
+
+#ifdef CONFIG_DEVICE
+  extern void sdl_clear_event_queue();// 清除 SDL 事件队列（如果启用设备
+  sdl_clear_event_queue();
+#endif
+
+  int i;
+  for (i = 0; i < NR_CMD; i ++) 
+  {
+    if (strcmp(cmd, cmd_table[i].name) == 0) // 查找匹配命令
+    {
+      return cmd_table[i].handler(args);// 执行命令，返回 -1 则退出
+    }
+  }
+
+  printf("Unknown command '%s'\n", cmd);// 未找到命令
+  return 0;
+}
+
+// 从文件或标准输入(-)逐行执行命令, 不经过 readline
+static void sdb_run_script(const char *file)
+{
+  FILE *fp = (strcmp(file, "-") == 0 ? stdin : fopen(file, "r"));
+  Assert(fp, "Can not open script '%s'", file);
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  while ((len = getline(&line, &size, fp)) >= 0)
+  {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[-- len] = '\0';
+    char *str = line;
+    while (*str == ' ' || *str == '\t') str ++;
+    if (*str == '\0' || *str == '#') continue;  // 空行和注释
+    printf("(nemu) %s\n", str);
+    if (sdb_exec(str) < 0) break;
+  }
+  free(line);
+  if (fp != stdin) fclose(fp);
+}
 
 // SDB 主循环：处理用户输入-----------------------------------------------//
 void sdb_mainloop() 
 {
+#ifdef CONFIG_GDBSTUB
+  if (gdb_addr != NULL) {
+    gdb_mainloop(gdb_addr);
+    return;
+  }
+#endif
+  if (script_file != NULL)
+  {
+    sdb_run_script(script_file);
+    return;
+  }
   if (is_batch_mode) 
   { 
     // 批处理模式：直接执行 'c' 命令
@@ -418,37 +703,7 @@ void sdb_mainloop()
   // 交互模式：循环读取输入
   for (char *str; (str = rl_gets()) != NULL; ) //相当于while 无限读输入直到null或eof错误
   {
-    char *str_end = str + strlen(str); // 输入字符串末尾  str代表开头
-
-    /* extract the first token as the command */
-    char *cmd = strtok(str, " "); //以空格分割得到第一个token
-    if (cmd == NULL) { continue; } // 空输入，跳过
-
-    /* treat the remaining string as the arguments,
-     * which may need further parsing
-     */
-    char *args = cmd + strlen(cmd) + 1; //得到第一个命令后args继续向后移动 得到命令的参数
-    if (args >= str_end)  //边界检查 如果越界就给null
-    {
-      args = NULL;
-    }
-
-#ifdef CONFIG_DEVICE
-    extern void sdl_clear_event_queue();// 清除 SDL 事件队列（如果启用设备
-    sdl_clear_event_queue();
-#endif
-
-    int i;
-    for (i = 0; i < NR_CMD; i ++) 
-    {
-      if (strcmp(cmd, cmd_table[i].name) == 0) // 查找匹配命令
-      {
-        if (cmd_table[i].handler(args) < 0) { return; }// 执行命令，如果返回 -1 则退出
-        break;
-      }
-    }
-
-    if (i == NR_CMD) { printf("Unknown command '%s'\n", cmd); }// 未找到命令
+    if (sdb_exec(str) < 0) { return; }
   }
 }
 
@@ -20,4 +20,28 @@
 
 word_t expr(char *e, bool *success);
 
+typedef struct ExprCode ExprCode;
+ExprCode *expr_compile(char *e, bool *success);
+word_t expr_run(ExprCode *code, bool *success);
+word_t expr_run_rec(ExprCode *code, bool *success, vaddr_t *addr, int *nr_addr, int max);
+int expr_regs(ExprCode *code, word_t **reg, int max);
+
+int bp_add(vaddr_t addr, char *cond);
+bool bp_del(int no);
+bool bp_del_addr(vaddr_t addr);
+bool bp_at(vaddr_t addr);
+void bp_display();
+
+bool replay_step_back(uint64_t n);
+bool replay_continue_back();
+void replay_display();
+
+void mem_find(char *args);
+void mem_save(const char *file);
+void mem_diff(const char *file);
+void expr_fuzz(uint64_t n, int nr_thread, uint64_t seed); // nr_thread = 0 for all CPUs
+
+void json_dump(const char *label);
+void json_report(bool is_assert);
+
 #endif
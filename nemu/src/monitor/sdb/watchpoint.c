@@ -18,23 +18,20 @@
 #include <stdlib.h>
 
 #include <common.h>
+#include <memory/paddr.h>
+#include <cpu/cpu.h>
+#include "watchpoint.h"
 
 #define NR_WP 32
 
-
-typedef struct watchpoint 
-{
-  int NO;
-  struct watchpoint *next;
-  char *expr;
-  word_t old_val;
-  /* TODO: Add more members if necessary */
-
-} WP;
-
 static WP wp_pool[NR_WP] = {};//全局
 static WP *head = NULL, *free_ = NULL; //全局
 
+// reference counts of the pmem blocks read by watchpoints, checked by pmem_write(),
+// allocated by init_mem() since pmem is also written without sdb (e.g. as a REF)
+uint16_t *wp_block = NULL;
+bool wp_mem_dirty = false;
+
 void init_wp_pool() {
   int i;
   for (i = 0; i < NR_WP; i ++) {
@@ -46,7 +43,43 @@ void init_wp_pool() {
   free_ = wp_pool;
 }
 
-WP *new_wp(const char *expr, word_t old_val)
+static void wp_unwatch_mem(WP *p)
+{
+  for (int i = 0; i < p->nr_block; i ++) wp_block[p->block[i]] --;
+  p->nr_block = 0;
+}
+
+static void wp_watch_block(WP *p, uint32_t b)
+{
+  for (int i = 0; i < p->nr_block; i ++) {
+    if (p->block[i] == b) return;
+  }
+  p->block[p->nr_block ++] = b;
+  wp_block[b] ++;
+}
+
+// evaluate the expr and update the pmem blocks it reads
+static bool wp_eval(WP *p, word_t *val)
+{
+  vaddr_t addr[WP_MAX_MEM];
+  int nr_addr;
+  bool success;
+  *val = expr_run_rec(p->code, &success, addr, &nr_addr, WP_MAX_MEM);
+  if (!success) return false;
+  if (wp_block == NULL) return true;
+
+  wp_unwatch_mem(p);
+  p->is_volatile = (p->nr_reg > WP_MAX_REG || nr_addr > WP_MAX_MEM);
+  for (int i = 0; i < nr_addr && i < WP_MAX_MEM; i ++) {
+    // the value of MMIO can change without being written
+    if (!in_pmem(addr[i]) || !in_pmem(addr[i] + 3)) { p->is_volatile = true; continue; }
+    wp_watch_block(p, (addr[i] - CONFIG_MBASE) >> WP_BLOCK_SHIFT);
+    wp_watch_block(p, (addr[i] + 3 - CONFIG_MBASE) >> WP_BLOCK_SHIFT);
+  }
+  return true;
+}
+
+WP *new_wp(const char *expr, ExprCode *code)
 {
 
   if(free_ == NULL)
@@ -61,9 +94,18 @@ WP *new_wp(const char *expr, word_t old_val)
     
     if(expr != NULL)
     {
+      p->code = code;
+      p->nr_block = 0;
+      p->nr_reg = expr_regs(code, p->reg, WP_MAX_REG);
+      for (int i = 0; i < p->nr_reg && i < WP_MAX_REG; i ++) p->reg_val[i] = *p->reg[i];
+      if (!wp_eval(p, &p->old_val))
+      {
+        p->next = free_;//求值失败 放回空闲表
+        free_ = p;
+        return NULL;
+      }
       p->expr = malloc(strlen(expr) + 1);//先分配再赋值
       strcpy(p->expr, expr);
-      p->old_val = old_val;
 
       p->next = head; //插入到head表
       head = p;
@@ -93,6 +135,9 @@ void free_wp(int no)
       free(target->expr); 
       target->expr = NULL; 
     }
+    if (wp_block) wp_unwatch_mem(target);
+    free(target->code);
+    target->code = NULL;
     target->old_val = 0;
 
     target->next = free_;//放回到free_表 空闲表中
@@ -114,6 +159,9 @@ void free_wp(int no)
         free(target->expr); 
         target->expr = NULL; 
       }
+      if (wp_block) wp_unwatch_mem(target);
+      free(target->code);
+      target->code = NULL;
       target->old_val = 0;
       target->next = free_;           // 放回空闲链表
       free_ = target;
@@ -145,35 +193,108 @@ int update_wp(void)
 {
   int change_times = 0;
   WP *ptr;
+  bool mem_dirty = wp_mem_dirty;
+  wp_mem_dirty = false;
 
-  ptr = head;
-
-  while (ptr != NULL)//检查每一个WP
+  for (ptr = head; ptr != NULL; ptr = ptr->next)//检查每一个WP
   {
-    bool success;
-    word_t new_val = expr(ptr->expr, &success);
-    if(!success)
+    // 只有读到的寄存器或内存被写过才重新求值
+    bool dirty = ptr->is_volatile || (mem_dirty && ptr->nr_block > 0);
+    for (int i = 0; i < ptr->nr_reg && i < WP_MAX_REG; i ++)
+    {
+      if (*ptr->reg[i] != ptr->reg_val[i]) { ptr->reg_val[i] = *ptr->reg[i]; dirty = true; }
+    }
+    if (!dirty) continue;
+
+    word_t new_val;
+    if(!wp_eval(ptr, &new_val))
     {
       printf("eval failure\n");
       continue;
     }
-    else
+    if(new_val != ptr->old_val)
     {
-      if(new_val != ptr->old_val)
-      { 
-        printf("WP NO.%d %s changed ",ptr->NO, ptr->expr);
-        printf("Old val is: 0x%08x, New is: 0x%08x \n",ptr->old_val, new_val);
-        change_times ++;
-        ptr->old_val = new_val;
-      }
+      printf("WP NO.%d %s changed ",ptr->NO, ptr->expr);
+      printf("Old val is: 0x%08x, New is: 0x%08x \n",ptr->old_val, new_val);
+      change_times ++;
+      ptr->old_val = new_val;
     }
+  }
 
+  return change_times;
+}
+
+// ----------- address watchpoints -----------
+
+// Watchpoints on an address range set by gdb (Z2/Z3/Z4 packets). Unlike the
+// ones above, they are checked on every data access of an instruction, so a
+// write of the same value or a read is also caught.
+#define NR_ADDR_WP 4
+
+static struct {
+  paddr_t addr;
+  int len;
+  int type;
+} addr_wp[NR_ADDR_WP];
+int wp_nr_addr = 0;
+// the first address watchpoint hit, see wp_addr_hit()
+static int hit_type = -1;
+static paddr_t hit_addr = 0;
+
+bool wp_add_addr(paddr_t addr, int len, int type) {
+  if (wp_nr_addr == NR_ADDR_WP) return false;
+  addr_wp[wp_nr_addr ++] = (typeof(addr_wp[0])) { .addr = addr, .len = len, .type = type };
+  return true;
+}
 
-    ptr = ptr->next;
+bool wp_del_addr(paddr_t addr, int len, int type) {
+  int i;
+  for (i = 0; i < wp_nr_addr; i ++) {
+    if (addr_wp[i].addr == addr && addr_wp[i].len == len && addr_wp[i].type == type) {
+      addr_wp[i] = addr_wp[-- wp_nr_addr];
+      return true;
+    }
   }
-  
-  return change_times;
+  return false;
+}
+
+// called by vaddr_read() and vaddr_write() when there are address watchpoints
+void wp_check_addr(paddr_t addr, int len, bool is_write) {
+  // the accesses of the debugger are not caught
+  if (!g_exec_inst || hit_type >= 0) return;
+  int i;
+  for (i = 0; i < wp_nr_addr; i ++) {
+    int type = addr_wp[i].type;
+    if (type != WP_ACCESS && (type == WP_WRITE) != is_write) continue;
+    if (addr < addr_wp[i].addr + addr_wp[i].len && addr_wp[i].addr < addr + len) {
+      hit_type = type;
+      hit_addr = addr_wp[i].addr;
+      return;
+    }
+  }
+}
+
+// Return the type of the address watchpoint hit in this run of cpu_exec(),
+// or -1. The address of the watchpoint is stored in `addr' if it is not NULL.
+int wp_addr_hit(paddr_t *addr) {
+  if (addr != NULL) *addr = hit_addr;
+  return hit_type;
+}
+
+void wp_addr_clear() {
+  hit_type = -1;
+}
 
+// re-evaluate all watchpoints after the state is changed by others, without reporting
+void wp_refresh(void)
+{
+  for (WP *ptr = head; ptr != NULL; ptr = ptr->next)
+  {
+    for (int i = 0; i < ptr->nr_reg && i < WP_MAX_REG; i ++) ptr->reg_val[i] = *ptr->reg[i];
+    word_t val;
+    if (wp_eval(ptr, &val)) ptr->old_val = val;
+  }
+  wp_mem_dirty = false;
 }
 
 
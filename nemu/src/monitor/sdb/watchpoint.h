@@ -1,25 +1,40 @@
 #ifndef __WATCHPOINT_H__
 #define __WATCHPOINT_H__
 
-#include <stdint.h>  // for word_t (假设 word_t 是 uint32_t 或类似)
+#include <common.h>
+
+#define WP_MAX_REG 8
+#define WP_MAX_MEM 16
 
 typedef struct watchpoint {
   int NO;
   struct watchpoint *next;
   char *expr;
   word_t old_val;
+  struct ExprCode *code;  // compiled expr
+
+  // the locations read by expr, it is re-evaluated only when one of them changes
+  word_t *reg[WP_MAX_REG];
+  word_t reg_val[WP_MAX_REG];
+  int nr_reg;
+  uint32_t block[WP_MAX_MEM * 2];  // pmem blocks read by the last evaluation
+  int nr_block;
+  bool is_volatile;  // reads MMIO or too many locations, evaluated after every instruction
   /* TODO: Add more members if necessary */
 } WP;
 
-// 全局变量声明（需在 watchpoint.c 中移除 static）
-extern WP *head;
-extern WP *free_;
-
 // 函数声明
 void init_wp_pool();
-WP *new_wp(const char *expr, word_t old_val);
+WP *new_wp(const char *expr, struct ExprCode *code);
 
 void free_wp(int no);
 void print_watchpoints();
 
-#endif
\ No newline at end of file
+// types of address watchpoints, the same as the Z packets of gdb
+enum { WP_WRITE = 2, WP_READ, WP_ACCESS };
+bool wp_add_addr(paddr_t addr, int len, int type);
+bool wp_del_addr(paddr_t addr, int len, int type);
+int wp_addr_hit(paddr_t *addr);
+void wp_addr_clear();
+
+#endif
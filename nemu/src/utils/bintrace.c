@@ -0,0 +1,104 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+/* Format of the binary instruction trace (see also tools/nemu-trace):
+ *   header: "NEMUTRC" '\0' | u8 version | u8 flags | u8 sizeof(word_t) | u8 len | ISA name[len]
+ *   record: varint((zigzag(pc - expected pc) << 4) | ilen) | inst[ilen] | rd value
+ * The expected pc is the pc of the previous record plus its ilen, so the
+ * pc of sequential instructions is encoded as a single byte. The rd value
+ * (sizeof(word_t) bytes) is only present with BINTRACE_FLAG_RD, and only
+ * for instructions writing a register other than zero.
+ */
+
+#define BINTRACE_VERSION 1
+#define BINTRACE_FLAG_RD 0x1
+
+#define BUF_SIZE (1024 * 1024)
+#define MAX_RECORD 64
+
+static FILE *trace_fp = NULL;
+static uint8_t buf[BUF_SIZE + MAX_RECORD] __attribute__((aligned(4096)));
+static uint8_t *p = buf;
+static vaddr_t expected_pc = 0;
+
+void bintrace_flush() {
+  if (trace_fp == NULL) return;
+  if (p != buf) {
+    size_t ret = fwrite(buf, 1, p - buf, trace_fp);
+    Assert(ret == p - buf, "Can not write the binary instruction trace");
+    p = buf;
+  }
+  fflush(trace_fp);
+}
+
+void init_bintrace(const char *file) {
+  trace_fp = fopen(file, "wb");
+  Assert(trace_fp, "Can not open '%s'", file);
+  // all writes are done in large blocks by bintrace_flush()
+  setvbuf(trace_fp, NULL, _IONBF, 0);
+
+  const char *isa = str(__GUEST_ISA__);
+  memcpy(p, "NEMUTRC", 8);
+  p += 8;
+  *p ++ = BINTRACE_VERSION;
+  *p ++ = MUXDEF(CONFIG_ITRACE_BINARY_RD, BINTRACE_FLAG_RD, 0);
+  *p ++ = sizeof(word_t);
+  *p ++ = strlen(isa);
+  memcpy(p, isa, strlen(isa));
+  p += strlen(isa);
+
+  atexit(bintrace_flush);
+  Log("Binary instruction trace is written to %s", file);
+}
+
+#ifdef CONFIG_ITRACE_BINARY_RD
+// the same rule is used by tools/nemu-trace
+static inline int inst_rd(uint32_t inst) {
+  int rd = BITS(inst, 11, 7);
+  switch (BITS(inst, 6, 0)) {
+    case 0x37: case 0x17: case 0x6f: case 0x67: // lui, auipc, jal, jalr
+    case 0x03: case 0x13: case 0x33:            // load, op-imm, op
+    case 0x1b: case 0x3b:                       // op-imm-32, op-32
+      return rd;
+    case 0x73: return (BITS(inst, 14, 12) != 0 ? rd : 0); // csr
+    default: return 0;
+  }
+}
+#endif
+
+void bintrace_write(vaddr_t pc, const void *inst, int ilen) {
+  int64_t delta = (sword_t)(pc - expected_pc);
+  uint64_t v = ((((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)) << 4) | ilen;
+  while (v >= 0x80) {
+    *p ++ = v | 0x80;
+    v >>= 7;
+  }
+  *p ++ = v;
+  memcpy(p, inst, ilen);
+  p += ilen;
+  expected_pc = pc + ilen;
+
+#ifdef CONFIG_ITRACE_BINARY_RD
+  int rd = inst_rd(*(uint32_t *)inst);
+  if (rd != 0) {
+    memcpy(p, &cpu.gpr[rd], sizeof(word_t));
+    p += sizeof(word_t);
+  }
+#endif
+
+  if (p >= buf + BUF_SIZE) bintrace_flush();
+}
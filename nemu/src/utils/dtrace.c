@@ -0,0 +1,178 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <device/map.h>
+
+// Device access tracer (dtrace) and exception tracer (etrace). Only the
+// events in the trace window set by the `trace' command are recorded.
+
+extern uint64_t g_nr_guest_inst;
+bool trace_window(vaddr_t pc);
+void timeline_mmio(const char *dev, int len);
+void timeline_intr(word_t NO, vaddr_t epc);
+
+#define NR_TRACED_MAP 32
+#define NR_CAUSE 32
+
+/* Format of the event log:
+ *   header: "NEMUEVT" '\0' | u32 version | u32 nr_dev | nr_dev * (u8 len | name[len]) | u64 nr_event
+ *   event:  u64 inst | u8 type | u8 len | u16 dev | u32 pad | u64 addr | u64 data
+ * dev is the index of the device in the header, starting from 1. For
+ * EVENT_INTR, addr is the epc and data is the cause. Only the latest
+ * CONFIG_EVENT_LOG_SIZE events are kept.
+ */
+#define EVENT_LOG_VERSION 1
+
+enum { EVENT_READ, EVENT_WRITE, EVENT_INTR };
+
+typedef struct {
+  uint64_t inst;
+  uint8_t type;
+  uint8_t len;
+  uint16_t dev;
+  uint32_t pad;
+  uint64_t addr;
+  uint64_t data;
+} Event;
+
+#ifdef CONFIG_EVENT_LOG
+static Event *event = NULL;
+static uint64_t nr_event = 0;
+
+static inline void log_event(int type, int dev, uint64_t addr, int len, uint64_t data) {
+  event[nr_event % CONFIG_EVENT_LOG_SIZE] = (Event) { .inst = g_nr_guest_inst, .type = type,
+    .len = len, .dev = dev, .addr = addr, .data = data };
+  nr_event ++;
+}
+#endif
+
+// ----------- dtrace -----------
+
+#ifdef CONFIG_DTRACE
+static IOMap *traced[NR_TRACED_MAP] = {};
+static int nr_traced = 0;
+
+void dtrace_access(IOMap *map, paddr_t addr, int len, word_t data, bool is_write, uint64_t callback_ns) {
+  if (!trace_window(cpu.pc)) return;
+  IOMapStat *st = &map->stat;
+  if (st->id == 0) {
+    assert(nr_traced < NR_TRACED_MAP);
+    traced[nr_traced ++] = map;
+    st->id = nr_traced;
+  }
+  if (is_write) st->nr_write ++;
+  else st->nr_read ++;
+  st->bytes += len;
+  st->callback_ns += callback_ns;
+  IFDEF(CONFIG_TIMELINE, timeline_mmio(map->name, len));
+  IFDEF(CONFIG_EVENT_LOG, log_event(is_write ? EVENT_WRITE : EVENT_READ, st->id, addr, len, data));
+}
+#endif
+
+// ----------- etrace -----------
+
+#ifdef CONFIG_ETRACE
+static struct {
+  word_t NO;
+  uint64_t count;
+} cause[NR_CAUSE] = {};
+static int nr_cause = 0;
+static uint64_t nr_other_cause = 0;
+
+void etrace(word_t NO, vaddr_t epc) {
+  if (!trace_window(epc)) return;
+  int i;
+  for (i = 0; i < nr_cause; i ++) {
+    if (cause[i].NO == NO) break;
+  }
+  if (i == nr_cause) {
+    if (nr_cause < NR_CAUSE) cause[nr_cause ++].NO = NO;
+    else { nr_other_cause ++; i = -1; }
+  }
+  if (i >= 0) cause[i].count ++;
+  IFDEF(CONFIG_EVENT_LOG, log_event(EVENT_INTR, 0, epc, 0, NO));
+  IFDEF(CONFIG_TIMELINE, timeline_intr(NO, epc));
+}
+#endif
+
+// ----------- report -----------
+
+#ifdef CONFIG_EVENT_LOG
+static void write_event_log(const char *file) {
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    Log("Can not open '%s', the event log is not written", file);
+    return;
+  }
+  uint32_t hdr[2] = { EVENT_LOG_VERSION, MUXDEF(CONFIG_DTRACE, nr_traced, 0) };
+  fwrite("NEMUEVT", 1, 8, fp);
+  fwrite(hdr, sizeof(hdr), 1, fp);
+#ifdef CONFIG_DTRACE
+  int i;
+  for (i = 0; i < nr_traced; i ++) {
+    uint8_t len = strlen(traced[i]->name);
+    fwrite(&len, 1, 1, fp);
+    fwrite(traced[i]->name, 1, len, fp);
+  }
+#endif
+  uint64_t n = (nr_event < CONFIG_EVENT_LOG_SIZE ? nr_event : CONFIG_EVENT_LOG_SIZE);
+  fwrite(&n, sizeof(n), 1, fp);
+  // oldest first
+  uint64_t start = (nr_event - n) % CONFIG_EVENT_LOG_SIZE;
+  uint64_t first = (start + n <= CONFIG_EVENT_LOG_SIZE ? n : CONFIG_EVENT_LOG_SIZE - start);
+  fwrite(event + start, sizeof(Event), first, fp);
+  fwrite(event, sizeof(Event), n - first, fp);
+  fclose(fp);
+  Log("%" PRIu64 " of %" PRIu64 " events are written to %s", n, nr_event, file);
+}
+#endif
+
+static void dtrace_report() {
+#ifdef CONFIG_DTRACE
+  if (nr_traced > 0) {
+    int i;
+    _Log("Device accesses:\n");
+    _Log("  %-12s %12s %12s %14s %14s %10s\n", "device", "reads", "writes", "bytes",
+        "callback(us)", "ns/access");
+    for (i = 0; i < nr_traced; i ++) {
+      IOMapStat *st = &traced[i]->stat;
+      uint64_t nr = st->nr_read + st->nr_write;
+      _Log("  %-12s %12" PRIu64 " %12" PRIu64 " %14" PRIu64 " %14" PRIu64 " %10" PRIu64 "\n",
+          traced[i]->name, st->nr_read, st->nr_write, st->bytes, st->callback_ns / 1000,
+          st->callback_ns / nr);
+    }
+  }
+#endif
+#ifdef CONFIG_ETRACE
+  if (nr_cause > 0) {
+    int i;
+    _Log("Exceptions and interrupts:\n");
+    for (i = 0; i < nr_cause; i ++) {
+      _Log("  cause = " FMT_WORD " %12" PRIu64 "\n", cause[i].NO, cause[i].count);
+    }
+    if (nr_other_cause > 0) _Log("  other causes %12" PRIu64 "\n", nr_other_cause);
+  }
+#endif
+  IFDEF(CONFIG_EVENT_LOG, write_event_log(CONFIG_EVENT_LOG_FILE));
+}
+
+void init_dtrace() {
+#ifdef CONFIG_EVENT_LOG
+  event = malloc(sizeof(Event) * CONFIG_EVENT_LOG_SIZE);
+  assert(event);
+#endif
+  atexit(dtrace_report);
+}
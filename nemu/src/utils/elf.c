@@ -0,0 +1,141 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <elf.h>
+
+#define Elf_Ehdr MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr)
+#define Elf_Shdr MUXDEF(CONFIG_ISA64, Elf64_Shdr, Elf32_Shdr)
+#define Elf_Sym  MUXDEF(CONFIG_ISA64, Elf64_Sym,  Elf32_Sym)
+#define ELF_ST_TYPE  MUXDEF(CONFIG_ISA64, ELF64_ST_TYPE, ELF32_ST_TYPE)
+#define ELF_ST_BIND  MUXDEF(CONFIG_ISA64, ELF64_ST_BIND, ELF32_ST_BIND)
+#define ELF_CLASS MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32)
+
+// function symbols of the guest program, sorted by address
+typedef struct {
+  vaddr_t addr;
+  word_t size;
+  const char *name;
+  bool is_func;
+} Symbol;
+
+static Symbol *sym = NULL;
+static int nr_sym = 0;
+static char *strtab = NULL;
+
+static int sym_cmp(const void *a, const void *b) {
+  const Symbol *x = a, *y = b;
+  if (x->addr != y->addr) return (x->addr < y->addr ? -1 : 1);
+  // prefer STT_FUNC when more symbols have the same address
+  return (int)y->is_func - (int)x->is_func;
+}
+
+static void *read_at(FILE *fp, long off, size_t size) {
+  void *buf = malloc(size);
+  assert(buf);
+  fseek(fp, off, SEEK_SET);
+  int ret = fread(buf, size, 1, fp);
+  Assert(ret == 1, "Can not read the ELF file");
+  return buf;
+}
+
+void init_elf(const char *elf_file) {
+  if (elf_file == NULL) return;
+
+  FILE *fp = fopen(elf_file, "rb");
+  Assert(fp, "Can not open '%s'", elf_file);
+
+  Elf_Ehdr *eh = read_at(fp, 0, sizeof(Elf_Ehdr));
+  Assert(memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 && eh->e_ident[EI_CLASS] == ELF_CLASS,
+      "'%s' is not a %d-bit ELF file", elf_file, (int)sizeof(word_t) * 8);
+  Elf_Shdr *sh = read_at(fp, eh->e_shoff, eh->e_shnum * sizeof(Elf_Shdr));
+
+  int i;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+    Elf_Sym *es = read_at(fp, sh[i].sh_offset, sh[i].sh_size);
+    strtab = read_at(fp, sh[sh[i].sh_link].sh_offset, sh[sh[i].sh_link].sh_size);
+    int n = sh[i].sh_size / sizeof(Elf_Sym);
+    sym = malloc(n * sizeof(Symbol));
+    assert(sym);
+
+    int j;
+    for (j = 0; j < n; j ++) {
+      int type = ELF_ST_TYPE(es[j].st_info);
+      const char *name = strtab + es[j].st_name;
+      // also take untyped global labels in code, such as `_start' written in assembly
+      bool in_code = (es[j].st_shndx != SHN_UNDEF && es[j].st_shndx < eh->e_shnum &&
+          (sh[es[j].st_shndx].sh_flags & SHF_EXECINSTR));
+      bool is_label = (type == STT_NOTYPE && ELF_ST_BIND(es[j].st_info) == STB_GLOBAL && in_code);
+      if ((type != STT_FUNC && !is_label) || name[0] == '\0') continue;
+      sym[nr_sym ++] = (Symbol) { .addr = es[j].st_value, .size = es[j].st_size,
+        .name = name, .is_func = (type == STT_FUNC) };
+    }
+    free(es);
+    break;
+  }
+  free(sh);
+  free(eh);
+  fclose(fp);
+
+  qsort(sym, nr_sym, sizeof(Symbol), sym_cmp);
+  // remove aliases
+  int k = 0;
+  for (i = 0; i < nr_sym; i ++) {
+    if (k > 0 && sym[k - 1].addr == sym[i].addr) continue;
+    sym[k ++] = sym[i];
+  }
+  nr_sym = k;
+
+  Log("Read %d function symbols from %s", nr_sym, elf_file);
+}
+
+int elf_nr_func() { return nr_sym; }
+const char *elf_func_name(int idx) { return sym[idx].name; }
+vaddr_t elf_func_addr(int idx) { return sym[idx].addr; }
+
+// the end of the function, a symbol without size extends to the next one
+vaddr_t elf_func_end(int idx) {
+  if (sym[idx].size != 0) return sym[idx].addr + sym[idx].size;
+  return (idx + 1 < nr_sym ? sym[idx + 1].addr : (vaddr_t)-1);
+}
+
+// return the index of the function containing `addr', or -1 if there is none
+int elf_func_index(vaddr_t addr) {
+  int l = 0, r = nr_sym - 1;
+  while (l <= r) {
+    int mid = (l + r) / 2;
+    if (sym[mid].addr <= addr) l = mid + 1;
+    else r = mid - 1;
+  }
+  if (r < 0) return -1;
+  // a symbol without size extends to the next one
+  if (sym[r].size != 0 && addr - sym[r].addr >= sym[r].size) return -1;
+  return r;
+}
+
+bool elf_func_lookup(const char *name, vaddr_t *addr) {
+  int i;
+  for (i = 0; i < nr_sym; i ++) {
+    if (strcmp(sym[i].name, name) == 0) {
+      *addr = sym[i].addr;
+      return true;
+    }
+  }
+  return false;
+}
+#endif
@@ -13,7 +13,38 @@
 # See the Mulan PSL v2 for more details.
 #**************************************************************************************/
 
-ifeq ($(CONFIG_ITRACE)$(CONFIG_IQUEUE),)
+ifndef CONFIG_ITRACE_BINARY
+SRCS-BLACKLIST-y += src/utils/bintrace.c
+endif
+
+ifndef CONFIG_TRACE
+SRCS-BLACKLIST-y += src/utils/itrace.c
+endif
+
+ifndef CONFIG_FTRACE
+SRCS-BLACKLIST-y += src/utils/ftrace.c
+endif
+
+ifndef CONFIG_PCSAMPLE
+SRCS-BLACKLIST-y += src/utils/pcsample.c
+endif
+
+ifndef CONFIG_INSTSTAT
+SRCS-BLACKLIST-y += src/utils/inststat.c
+endif
+
+ifeq ($(CONFIG_DTRACE)$(CONFIG_ETRACE),)
+SRCS-BLACKLIST-y += src/utils/dtrace.c
+endif
+
+ifndef CONFIG_TIMELINE
+SRCS-BLACKLIST-y += src/utils/timeline.c
+endif
+
+ifeq ($(CONFIG_ITRACE)$(CONFIG_IQUEUE)$(CONFIG_PCSAMPLE),)
+SRCS-BLACKLIST-y += src/utils/disasm.c src/isa/riscv32/disasm.c
+else ifeq ($(GUEST_ISA),riscv32)
+# riscv32 uses the built-in disassembler in src/isa/riscv32/disasm.c
 SRCS-BLACKLIST-y += src/utils/disasm.c
 else
 LIBCAPSTONE = tools/capstone/repo/libcapstone.so.5
@@ -0,0 +1,281 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+/* Function profiler. The ISA reports calls and returns, and the time spent
+ * in a function is measured by the number of guest instructions between
+ * them, so nothing is done for the other instructions. Every distinct call
+ * stack is a node of the calling context tree, which is used to produce
+ * both the call graph and the collapsed stacks for flame graphs.
+ * Only the instructions and calls in the instruction range of the trace
+ * window are counted. The call stack is still followed outside the window,
+ * and the pc filter of the window is not applied, since it would cut the
+ * stack.
+ */
+
+extern uint64_t g_nr_guest_inst;
+extern uint64_t g_trace_start, g_trace_end;
+void timeline_func(bool is_call, const char *name);
+
+#define MAX_DEPTH 4096
+#define MAX_NODE (1 << 18)
+#define HASH_SIZE (MAX_NODE * 2)
+#define NR_TOP 30
+
+typedef struct {
+  int func;
+  int parent;
+  uint64_t calls, incl, excl;
+} Node;
+
+typedef struct {
+  int func;
+  int node;
+  vaddr_t ret_addr;
+  uint64_t enter;   // index of the first instruction of the function
+  uint64_t child;   // instructions spent in callees
+} Frame;
+
+typedef struct {
+  uint64_t calls, incl, excl;
+  int depth;        // active frames of the function, to count recursion once
+} FuncStat;
+
+static Node node[MAX_NODE];
+static int nr_node = 0;
+static int node_hash[HASH_SIZE];   // index of node + 1, 0 means empty
+static Frame stack[MAX_DEPTH];
+static int sp = 0;
+static FuncStat *stat = NULL;
+static int nr_func = 0;            // the last one is for code without symbol
+static bool ftrace_on = false;
+static uint64_t nr_lost = 0;
+static uint64_t nr_counted = 0;    // instructions counted in the window
+static uint64_t last = 0;          // index of the instruction when `nr_counted' is updated
+
+// advance `nr_counted' to the instruction with index `now', where the instructions
+// in [last, now) are counted if they are in the window
+static uint64_t tick(uint64_t now) {
+  if (now > last) {
+    uint64_t lo = (last > g_trace_start ? last : g_trace_start);
+    uint64_t hi = (now - 1 > g_trace_end ? g_trace_end + 1 : now);
+    if (hi > lo) nr_counted += hi - lo;
+  }
+  // g_nr_guest_inst goes backward after a replay
+  last = now;
+  return nr_counted;
+}
+
+static inline bool in_window(uint64_t idx) {
+  return idx >= g_trace_start && idx <= g_trace_end;
+}
+
+static const char *func_name(int f) {
+  return (f == nr_func - 1 ? "??" : elf_func_name(f));
+}
+
+static int get_child(int parent, int func) {
+  uint32_t h = ((uint32_t)parent * 0x9e3779b1u ^ (uint32_t)func * 0x85ebca6bu) & (HASH_SIZE - 1);
+  while (node_hash[h] != 0) {
+    Node *n = &node[node_hash[h] - 1];
+    if (n->parent == parent && n->func == func) return node_hash[h] - 1;
+    h = (h + 1) & (HASH_SIZE - 1);
+  }
+  if (nr_node == MAX_NODE) return -1;
+  node[nr_node] = (Node) { .func = func, .parent = parent };
+  node_hash[h] = ++ nr_node;
+  return nr_node - 1;
+}
+
+void ftrace_call(vaddr_t target, vaddr_t ret_addr) {
+  if (!ftrace_on) return;
+  if (sp == MAX_DEPTH) { nr_lost ++; return; }
+  int f = elf_func_index(target);
+  if (f < 0) f = nr_func - 1;
+  Frame *top = &stack[sp - 1];
+  int n = get_child(top->node, f);
+  // if the tree is full, the call stack is truncated at the caller
+  bool counted = in_window(g_nr_guest_inst + 1);
+  if (n < 0) { n = top->node; nr_lost ++; }
+  else node[n].calls += counted;
+  stack[sp ++] = (Frame) { .func = f, .node = n, .ret_addr = ret_addr,
+    .enter = tick(g_nr_guest_inst + 1), .child = 0 };
+  stat[f].calls += counted;
+  stat[f].depth ++;
+  IFDEF(CONFIG_TIMELINE, timeline_func(true, func_name(f)));
+}
+
+static void pop(uint64_t now) {
+  Frame *f = &stack[-- sp];
+  uint64_t incl = now - f->enter;
+  uint64_t excl = incl - f->child;
+  if (sp > 0) stack[sp - 1].child += incl;
+  node[f->node].incl += incl;
+  node[f->node].excl += excl;
+  FuncStat *st = &stat[f->func];
+  st->excl += excl;
+  if (-- st->depth == 0) st->incl += incl;
+  IFDEF(CONFIG_TIMELINE, timeline_func(false, func_name(f->func)));
+}
+
+void ftrace_ret(vaddr_t target) {
+  if (!ftrace_on) return;
+  // usually the top frame; deeper frames are unwound by longjmp()
+  int i;
+  for (i = sp - 1; i > 0; i --) {
+    if (stack[i].ret_addr == target) break;
+  }
+  if (i == 0) return;
+  // the return instruction belongs to the callee
+  uint64_t now = tick(g_nr_guest_inst + 1);
+  while (sp > i) pop(now);
+}
+
+// a coroutine switch returns from the current function and calls `target'
+void ftrace_switch(vaddr_t target, vaddr_t ret_addr) {
+  if (!ftrace_on) return;
+  if (sp > 1) pop(tick(g_nr_guest_inst + 1));
+  ftrace_call(target, ret_addr);
+}
+
+// ----------- report -----------
+
+typedef struct {
+  int caller, callee;
+  uint64_t calls, incl;
+} Edge;
+
+static int *by_excl = NULL;
+
+static int excl_cmp(const void *a, const void *b) {
+  uint64_t x = stat[*(int *)a].excl, y = stat[*(int *)b].excl;
+  return (x < y) - (x > y);
+}
+
+static int edge_cmp(const void *a, const void *b) {
+  const Edge *x = a, *y = b;
+  if (x->caller != y->caller) return x->caller - y->caller;
+  if (x->callee != y->callee) return x->callee - y->callee;
+  return 0;
+}
+
+static void write_folded(const char *file) {
+  FILE *fp = fopen(file, "w");
+  if (fp == NULL) {
+    Log("Can not open '%s', the collapsed stacks are not written", file);
+    return;
+  }
+  static int path[MAX_DEPTH + 1];
+  int i;
+  for (i = 0; i < nr_node; i ++) {
+    if (node[i].excl == 0) continue;
+    int depth = 0, n;
+    for (n = i; n >= 0; n = node[n].parent) path[depth ++] = node[n].func;
+    while (depth > 0) {
+      depth --;
+      fprintf(fp, "%s%c", func_name(path[depth]), (depth == 0 ? ' ' : ';'));
+    }
+    fprintf(fp, "%" PRIu64 "\n", node[i].excl);
+  }
+  fclose(fp);
+  Log("Collapsed call stacks are written to %s", file);
+}
+
+static void ftrace_report() {
+  uint64_t now = tick(g_nr_guest_inst + 1);
+  while (sp > 0) pop(now);
+  uint64_t total = (now == 0 ? 1 : now);
+
+  by_excl = malloc(sizeof(int) * nr_func);
+  int i, nr = 0;
+  for (i = 0; i < nr_func; i ++) {
+    if (stat[i].calls != 0) by_excl[nr ++] = i;
+  }
+  qsort(by_excl, nr, sizeof(int), excl_cmp);
+  if (nr > NR_TOP) nr = NR_TOP;
+
+  _Log("Flat profile of the %" PRIu64 " instructions in the trace window (unit: guest instructions):\n", now);
+  _Log("  %%self          self         total      calls  function\n");
+  for (i = 0; i < nr; i ++) {
+    FuncStat *st = &stat[by_excl[i]];
+    _Log("%6.2f%% %13" PRIu64 " %13" PRIu64 " %10" PRIu64 "  %s\n", st->excl * 100.0 / total,
+        st->excl, st->incl, st->calls, func_name(by_excl[i]));
+  }
+
+  // merge the nodes with the same caller and callee into edges
+  Edge *edge = malloc(sizeof(Edge) * nr_node);
+  int nr_edge = 0;
+  for (i = 1; i < nr_node; i ++) {
+    edge[nr_edge ++] = (Edge) { .caller = node[node[i].parent].func, .callee = node[i].func,
+      .calls = node[i].calls, .incl = node[i].incl };
+  }
+  qsort(edge, nr_edge, sizeof(Edge), edge_cmp);
+  int k = 0;
+  for (i = 0; i < nr_edge; i ++) {
+    if (k > 0 && edge_cmp(&edge[k - 1], &edge[i]) == 0) {
+      edge[k - 1].calls += edge[i].calls;
+      edge[k - 1].incl += edge[i].incl;
+    } else edge[k ++] = edge[i];
+  }
+  nr_edge = k;
+
+  _Log("Call graph of the functions above:\n");
+  for (i = 0; i < nr; i ++) {
+    int f = by_excl[i], j;
+    _Log("%s\n", func_name(f));
+    for (j = 0; j < nr_edge; j ++) {
+      if (edge[j].callee == f) {
+        _Log("    <- %-24s %10" PRIu64 " calls\n", func_name(edge[j].caller), edge[j].calls);
+      }
+    }
+    for (j = 0; j < nr_edge; j ++) {
+      if (edge[j].caller == f) {
+        _Log("    -> %-24s %10" PRIu64 " calls %13" PRIu64 " insts\n",
+            func_name(edge[j].callee), edge[j].calls, edge[j].incl);
+      }
+    }
+  }
+  if (nr_lost != 0) _Log("%" PRIu64 " calls are not fully recorded due to deep call stacks\n", nr_lost);
+  free(edge);
+  free(by_excl);
+
+  write_folded(CONFIG_FTRACE_FOLDED_FILE);
+}
+
+void init_ftrace() {
+  if (elf_nr_func() == 0) {
+    Log("No function symbol is found, the function profiler is disabled. Use --elf=FILE to provide them");
+    return;
+  }
+  nr_func = elf_nr_func() + 1;
+  stat = calloc(nr_func, sizeof(FuncStat));
+  assert(stat);
+
+  // the root of the tree is the function at the entry
+  int f = elf_func_index(cpu.pc);
+  if (f < 0) f = nr_func - 1;
+  node[0] = (Node) { .func = f, .parent = -1, .calls = 1 };
+  nr_node = 1;
+  last = g_nr_guest_inst + 1;
+  stack[0] = (Frame) { .func = f, .node = 0, .enter = tick(last) };
+  sp = 1;
+  stat[f].calls = 1;
+  stat[f].depth = 1;
+  IFDEF(CONFIG_TIMELINE, timeline_func(true, func_name(f)));
+
+  ftrace_on = true;
+  atexit(ftrace_report);
+}
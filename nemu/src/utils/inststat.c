@@ -0,0 +1,112 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+
+extern uint64_t g_nr_guest_inst;
+
+InstStat g_inststat = {};
+
+// defined by the linker, weak in case the ISA does not use INSTSTAT()
+extern InstPatStat __start_nemu_inststat[] __attribute__((weak));
+extern InstPatStat __stop_nemu_inststat[] __attribute__((weak));
+
+static const int width[] = { 1, 2, 4, 8 };
+
+// all the counters, saved in the checkpoints of reverse execution
+uint64_t *inststat_save() {
+  int nr_site = __stop_nemu_inststat - __start_nemu_inststat;
+  uint64_t *buf = malloc(sizeof(InstStat) + sizeof(uint64_t) * nr_site);
+  assert(buf);
+  memcpy(buf, &g_inststat, sizeof(InstStat));
+  int i;
+  for (i = 0; i < nr_site; i ++) buf[sizeof(InstStat) / sizeof(uint64_t) + i] = __start_nemu_inststat[i].count;
+  return buf;
+}
+
+void inststat_restore(const uint64_t *buf) {
+  int nr_site = __stop_nemu_inststat - __start_nemu_inststat;
+  memcpy(&g_inststat, buf, sizeof(InstStat));
+  int i;
+  for (i = 0; i < nr_site; i ++) __start_nemu_inststat[i].count = buf[sizeof(InstStat) / sizeof(uint64_t) + i];
+}
+
+static int count_cmp(const void *a, const void *b) {
+  uint64_t x = (*(InstPatStat **)a)->count, y = (*(InstPatStat **)b)->count;
+  return (x < y) - (x > y);
+}
+
+static void write_json(const char *file, InstPatStat **site, int nr_site) {
+  FILE *fp = fopen(file, "w");
+  if (fp == NULL) {
+    Log("Can not open '%s', the statistics are not written", file);
+    return;
+  }
+  int i;
+  fprintf(fp, "{\n  \"instructions\": %" PRIu64 ",\n  \"mix\": {", g_nr_guest_inst);
+  for (i = 0; i < nr_site; i ++) {
+    fprintf(fp, "%s\n    \"%s\": %" PRIu64, (i == 0 ? "" : ","), site[i]->name, site[i]->count);
+  }
+  fprintf(fp, "\n  },\n  \"load\": {");
+  for (i = 0; i < ARRLEN(width); i ++) {
+    fprintf(fp, "%s \"%d\": %" PRIu64, (i == 0 ? "" : ","), width[i], g_inststat.load[width[i]]);
+  }
+  fprintf(fp, " },\n  \"store\": {");
+  for (i = 0; i < ARRLEN(width); i ++) {
+    fprintf(fp, "%s \"%d\": %" PRIu64, (i == 0 ? "" : ","), width[i], g_inststat.store[width[i]]);
+  }
+  fprintf(fp, " },\n  \"branch\": { \"taken\": %" PRIu64 ", \"not_taken\": %" PRIu64 " },\n",
+      g_inststat.branch[1], g_inststat.branch[0]);
+  fprintf(fp, "  \"mmio\": { \"read\": %" PRIu64 ", \"write\": %" PRIu64 " }\n}\n",
+      g_inststat.mmio_read, g_inststat.mmio_write);
+  fclose(fp);
+  Log("Instruction statistics are written to %s", file);
+}
+
+void inststat_report() {
+  int nr_site = __stop_nemu_inststat - __start_nemu_inststat;
+  InstPatStat **site = malloc(sizeof(InstPatStat *) * (nr_site + 1));
+  int i, n = 0;
+  for (i = 0; i < nr_site; i ++) {
+    if (__start_nemu_inststat[i].count != 0) site[n ++] = &__start_nemu_inststat[i];
+  }
+  qsort(site, n, sizeof(InstPatStat *), count_cmp);
+
+  double total = (g_nr_guest_inst == 0 ? 1 : g_nr_guest_inst);
+  Log("instruction mix:");
+  for (i = 0; i < n; i ++) {
+    Log("  %-8s %18" PRIu64 " %6.2f%%", site[i]->name, site[i]->count, site[i]->count * 100 / total);
+  }
+
+  uint64_t nr_load = 0, nr_store = 0;
+  for (i = 0; i < ARRLEN(width); i ++) {
+    nr_load += g_inststat.load[width[i]];
+    nr_store += g_inststat.store[width[i]];
+  }
+  Log("loads  = " NUMBERIC_FMT " (1B: " NUMBERIC_FMT ", 2B: " NUMBERIC_FMT ", 4B: " NUMBERIC_FMT ", 8B: " NUMBERIC_FMT ")",
+      nr_load, g_inststat.load[1], g_inststat.load[2], g_inststat.load[4], g_inststat.load[8]);
+  Log("stores = " NUMBERIC_FMT " (1B: " NUMBERIC_FMT ", 2B: " NUMBERIC_FMT ", 4B: " NUMBERIC_FMT ", 8B: " NUMBERIC_FMT ")",
+      nr_store, g_inststat.store[1], g_inststat.store[2], g_inststat.store[4], g_inststat.store[8]);
+  uint64_t nr_branch = g_inststat.branch[0] + g_inststat.branch[1];
+  Log("branches = " NUMBERIC_FMT ", taken = " NUMBERIC_FMT " (%.2f%%)", nr_branch, g_inststat.branch[1],
+      g_inststat.branch[1] * 100.0 / (nr_branch == 0 ? 1 : nr_branch));
+  Log("memory accesses: pmem = " NUMBERIC_FMT ", mmio read = " NUMBERIC_FMT ", mmio write = " NUMBERIC_FMT,
+      nr_load + nr_store - g_inststat.mmio_read - g_inststat.mmio_write,
+      g_inststat.mmio_read, g_inststat.mmio_write);
+
+  if (CONFIG_INSTSTAT_JSON[0] != '\0') write_json(CONFIG_INSTSTAT_JSON, site, n);
+  free(site);
+}
@@ -0,0 +1,142 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <cpu/decode.h>
+
+/* Instruction tracer. The execution loop calls itrace_hook after every
+ * instruction, and the hook is switched by itrace_update() when the trace
+ * window opens or closes, so nothing is formatted outside the window.
+ * execute() asks itrace_update() for the length of the next batch, which
+ * ends at the next boundary of the window.
+ * The window is configured here for all tracers, see itrace_config().
+ */
+
+extern uint64_t g_nr_guest_inst;
+extern uint64_t g_trace_start, g_trace_end;
+extern vaddr_t g_trace_pc_lo, g_trace_pc_hi;
+extern bool g_trace_pc_filter;
+
+#ifdef CONFIG_ITRACE
+void format_inst(char *buf, int size, vaddr_t pc, uint8_t *inst, int ilen);
+
+static inline void format(Decode *s) {
+  format_inst(s->logbuf, sizeof(s->logbuf), s->pc, (uint8_t *)&s->isa.inst, s->snpc - s->pc);
+}
+
+static inline bool pc_match(vaddr_t pc) {
+  return !g_trace_pc_filter || (pc >= g_trace_pc_lo && pc < g_trace_pc_hi);
+}
+
+static void itrace_off(Decode *s) {
+}
+
+static void itrace_on(Decode *s) {
+  if (ITRACE_COND) {
+    format(s);
+    log_write("%s\n", s->logbuf);
+  }
+}
+
+static void itrace_on_filtered(Decode *s) {
+  if (pc_match(s->pc)) itrace_on(s);
+}
+
+// single stepping, also print the instruction to the screen
+static void itrace_step(Decode *s) {
+  format(s);
+  if (ITRACE_COND && pc_match(s->pc)) log_write("%s\n", s->logbuf);
+  puts(s->logbuf);
+}
+
+void (*itrace_hook)(Decode *s) = itrace_off;
+
+// select the hook for the next instruction, and return how many of the
+// next `n' instructions can be executed before the window changes
+uint64_t itrace_update(uint64_t n, bool print_step) {
+  // g_nr_guest_inst is checked by log_enable() after it is increased
+  uint64_t next = g_nr_guest_inst + 1;
+  bool active = (next >= g_trace_start && next <= g_trace_end);
+  itrace_hook = (print_step ? itrace_step : !active ? itrace_off :
+      g_trace_pc_filter ? itrace_on_filtered : itrace_on);
+  uint64_t left = (next < g_trace_start ? g_trace_start - next :
+      active ? g_trace_end - next + 1 : UINT64_MAX);
+  return (left != 0 && left < n ? left : n);
+}
+#endif
+
+// ----------- configuration -----------
+
+static void itrace_status() {
+  if (g_trace_start > g_trace_end) printf("The trace window is off\n");
+  else printf("The trace window is instructions [%" PRIu64 ", %" PRIu64 "]\n",
+      g_trace_start, g_trace_end);
+  if (g_trace_pc_filter) printf("Only instructions with pc in [" FMT_WORD ", " FMT_WORD ") are traced\n",
+      g_trace_pc_lo, g_trace_pc_hi);
+}
+
+static bool parse_num(const char *s, uint64_t *val) {
+  char *end;
+  if (s == NULL) return false;
+  *val = strtoull(s, &end, 0);
+  return *end == '\0';
+}
+
+/* The window is shared by ftrace (instruction range only), dtrace and etrace.
+ * Syntax of `args':
+ *   on | off            trace all instructions or nothing
+ *   inst START [END]    trace the START-th to the END-th instructions
+ *   pc LO HI            only trace instructions with pc in [LO, HI)
+ *   func NAME           only trace instructions in the function NAME
+ *   all                 remove the pc filter
+ * The status is printed when `args' is empty.
+ */
+bool itrace_config(const char *args) {
+  char buf[128];
+  char *save = NULL;
+  snprintf(buf, sizeof(buf), "%s", (args ? args : ""));
+  char *op = strtok_r(buf, " ", &save);
+  char *arg1 = strtok_r(NULL, " ", &save);
+  char *arg2 = strtok_r(NULL, " ", &save);
+  uint64_t lo, hi;
+
+  if (op == NULL) { itrace_status(); return true; }
+  if (strcmp(op, "on") == 0) { g_trace_start = 0; g_trace_end = UINT64_MAX; }
+  else if (strcmp(op, "off") == 0) { g_trace_start = UINT64_MAX; g_trace_end = 0; }
+  else if (strcmp(op, "inst") == 0 && parse_num(arg1, &lo)) {
+    if (arg2 == NULL) hi = UINT64_MAX;
+    else if (!parse_num(arg2, &hi)) return false;
+    g_trace_start = lo;
+    g_trace_end = hi;
+  }
+  else if (strcmp(op, "pc") == 0 && parse_num(arg1, &lo) && parse_num(arg2, &hi)) {
+    g_trace_pc_lo = lo;
+    g_trace_pc_hi = hi;
+    g_trace_pc_filter = true;
+  }
+  else if (strcmp(op, "func") == 0 && arg1 != NULL) {
+    vaddr_t addr;
+    if (!elf_func_lookup(arg1, &addr)) {
+      printf("Function '%s' is not found, use --elf=FILE to provide the symbols\n", arg1);
+      return false;
+    }
+    int idx = elf_func_index(addr);
+    g_trace_pc_lo = addr;
+    g_trace_pc_hi = elf_func_end(idx);
+    g_trace_pc_filter = true;
+  }
+  else if (strcmp(op, "all") == 0) g_trace_pc_filter = false;
+  else return false;
+  return true;
+}
@@ -20,18 +20,250 @@ extern uint64_t g_nr_guest_inst;
 #ifndef CONFIG_TARGET_AM
 FILE *log_fp = NULL;
 
+#ifdef CONFIG_LOG_ASYNC
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <unistd.h>
+#ifdef CONFIG_LOG_ASYNC_GZIP
+#include <zlib.h>
+#endif
+
+/* Asynchronous log writer. Producers reserve a range of the ring buffer by
+ * advancing `reserve`, copy the message, and publish it by advancing
+ * `commit` in the order of reservation. The writer thread writes the
+ * committed data to the file in large chunks and advances `drain`.
+ * The fast path takes no lock. A producer which finds the ring full sleeps
+ * on `space` and wakes up the writer, which broadcasts `space` after
+ * draining if any producer is blocked.
+ */
+
+#define LOG_BUF_SIZE CONFIG_LOG_ASYNC_BUF_SIZE
+// the writer waits for this much data before writing, unless it is idle
+#define LOG_CHUNK (LOG_BUF_SIZE / 4 < 64 * 1024 ? LOG_BUF_SIZE / 4 : 64 * 1024)
+
+static char *log_buf = NULL;
+static uint64_t reserve = 0, commit = 0, drain = 0;
+static bool async = false;
+static bool stop = false;
+static bool flush_req = false;
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;   // for the writer
+static pthread_cond_t space = PTHREAD_COND_INITIALIZER;  // for the blocked producers
+static int nr_blocked = 0;
+static uint64_t nr_drop = 0, nr_wait = 0;
+#ifdef CONFIG_LOG_ASYNC_GZIP
+static gzFile gz = NULL;
+#endif
+
+static void log_out(const char *s, size_t len) {
+#ifdef CONFIG_LOG_ASYNC_GZIP
+  gzwrite(gz, s, len);
+#else
+  fwrite(s, 1, len, log_fp);
+#endif
+}
+
+// write the committed data, return the number of bytes written
+static uint64_t log_drain(bool all) {
+  uint64_t c = __atomic_load_n(&commit, __ATOMIC_ACQUIRE);
+  uint64_t d = drain;
+  if (c - d < (all ? 1 : LOG_CHUNK)) return 0;
+  while (d != c) {
+    uint64_t off = d % LOG_BUF_SIZE;
+    uint64_t len = c - d;
+    if (len > LOG_BUF_SIZE - off) len = LOG_BUF_SIZE - off;
+    log_out(log_buf + off, len);
+    d += len;
+  }
+  uint64_t n = d - drain;
+  // pairs with the check of a blocked producer in log_push()
+  __atomic_store_n(&drain, d, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&nr_blocked, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&space);
+    pthread_mutex_unlock(&lock);
+  }
+  return n;
+}
+
+static bool ring_full(uint64_t start, size_t len) {
+  return start + len - __atomic_load_n(&drain, __ATOMIC_SEQ_CST) > LOG_BUF_SIZE;
+}
+
+static void wake_writer() {
+  pthread_mutex_lock(&lock);
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+}
+
+static void log_sync() {
+  log_drain(true);
+  MUXDEF(CONFIG_LOG_ASYNC_GZIP, gzflush(gz, Z_SYNC_FLUSH), fflush(log_fp));
+}
+
+static void *log_writer(void *arg) {
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+    if (__atomic_load_n(&flush_req, __ATOMIC_ACQUIRE)) {
+      log_sync();
+      __atomic_store_n(&flush_req, false, __ATOMIC_RELEASE);
+    }
+    else if (log_drain(false) == 0) {
+      // write the partial chunk after an idle period, or at once if a
+      // producer is blocked
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 1000000;
+      if (ts.tv_nsec >= 1000000000) { ts.tv_sec ++; ts.tv_nsec -= 1000000000; }
+      pthread_mutex_lock(&lock);
+      if (nr_blocked == 0 && !__atomic_load_n(&stop, __ATOMIC_ACQUIRE) &&
+          !__atomic_load_n(&flush_req, __ATOMIC_ACQUIRE)) {
+        pthread_cond_timedwait(&wake, &lock, &ts);
+      }
+      pthread_mutex_unlock(&lock);
+      log_drain(true);
+    }
+  }
+  log_drain(true);
+  return NULL;
+}
+
+static void log_push(const char *s, size_t len) {
+  if (len > LOG_BUF_SIZE / 2) len = LOG_BUF_SIZE / 2;
+  uint64_t start;
+  // the free space is checked again on every attempt
+  for (;;) {
+    start = __atomic_load_n(&reserve, __ATOMIC_RELAXED);
+    if (ring_full(start, len)) {
+#ifdef CONFIG_LOG_ASYNC_DROP
+      __atomic_fetch_add(&nr_drop, 1, __ATOMIC_RELAXED);
+      return;
+#else
+      __atomic_fetch_add(&nr_wait, 1, __ATOMIC_RELAXED);
+      pthread_mutex_lock(&lock);
+      __atomic_fetch_add(&nr_blocked, 1, __ATOMIC_SEQ_CST);
+      pthread_cond_signal(&wake);
+      while (ring_full(start, len)) pthread_cond_wait(&space, &lock);
+      __atomic_fetch_sub(&nr_blocked, 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&lock);
+      continue;
+#endif
+    }
+    if (__atomic_compare_exchange_n(&reserve, &start, start + len, true,
+          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+  }
+
+  uint64_t off = start % LOG_BUF_SIZE;
+  size_t first = (len > LOG_BUF_SIZE - off ? LOG_BUF_SIZE - off : len);
+  memcpy(log_buf + off, s, first);
+  memcpy(log_buf, s + first, len - first);
+
+  // publish in the order of reservation
+  while (__atomic_load_n(&commit, __ATOMIC_ACQUIRE) != start) sched_yield();
+  __atomic_store_n(&commit, start + len, __ATOMIC_RELEASE);
+}
+
+void log_printf(const char *fmt, ...) {
+  char buf[1024];
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len < 0) return;
+  if (!async) {
+    fwrite(buf, 1, (len < sizeof(buf) ? len : sizeof(buf) - 1), log_fp);
+    fflush(log_fp);
+    return;
+  }
+  if (len < sizeof(buf)) { log_push(buf, len); return; }
+  char *p = malloc(len + 1);
+  va_start(ap, fmt);
+  vsnprintf(p, len + 1, fmt, ap);
+  va_end(ap);
+  log_push(p, len);
+  free(p);
+}
+
+static void log_close() {
+  if (!async) return;
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  wake_writer();
+  pthread_join(writer, NULL);
+  async = false;
+  IFDEF(CONFIG_LOG_ASYNC_GZIP, gzclose(gz));
+  fclose(log_fp);
+  log_fp = NULL;
+  if (nr_drop > 0) printf("%" PRIu64 " log messages are dropped since the log buffer is full\n", nr_drop);
+  if (nr_wait > 0) printf("The emulator waited %" PRIu64 " times for the log writer\n", nr_wait);
+}
+
+static void init_log_async() {
+  assert((LOG_BUF_SIZE & (LOG_BUF_SIZE - 1)) == 0);
+  log_buf = aligned_alloc(4096, LOG_BUF_SIZE);
+  assert(log_buf);
+#ifdef CONFIG_LOG_ASYNC_GZIP
+  fflush(log_fp);
+  gz = gzdopen(dup(fileno(log_fp)), "wb1");
+  assert(gz);
+#else
+  setvbuf(log_fp, NULL, _IOFBF, LOG_CHUNK);
+#endif
+  int ret = pthread_create(&writer, NULL, log_writer, NULL);
+  assert(ret == 0);
+  async = true;
+  atexit(log_close);
+}
+#endif
+
+// make sure the messages so far reach the file, e.g. before abort()
+void log_flush() {
+  if (log_fp == NULL) return;
+#ifdef CONFIG_LOG_ASYNC
+  if (async) {
+    // the file is only touched by the writer thread
+    uint64_t r = __atomic_load_n(&reserve, __ATOMIC_ACQUIRE);
+    while (__atomic_load_n(&commit, __ATOMIC_ACQUIRE) < r) sched_yield();
+    __atomic_store_n(&flush_req, true, __ATOMIC_RELEASE);
+    wake_writer();
+    while (__atomic_load_n(&flush_req, __ATOMIC_ACQUIRE)) sched_yield();
+    return;
+  }
+#endif
+  fflush(log_fp);
+}
+
 void init_log(const char *log_file) {
   log_fp = stdout;
   if (log_file != NULL) {
     FILE *fp = fopen(log_file, "w");
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
+    IFDEF(CONFIG_LOG_ASYNC, init_log_async());
   }
   Log("Log is written to %s", log_file ? log_file : "stdout");
 }
 
+#ifdef CONFIG_TRACE
+// the trace window, which can be changed at runtime by the `trace' command
+uint64_t g_trace_start = CONFIG_TRACE_START;
+uint64_t g_trace_end = CONFIG_TRACE_END;
+// only trace instructions with pc in [g_trace_pc_lo, g_trace_pc_hi)
+vaddr_t g_trace_pc_lo = 0, g_trace_pc_hi = 0;
+bool g_trace_pc_filter = false;
+#endif
+
 bool log_enable() {
-  return MUXDEF(CONFIG_TRACE, (g_nr_guest_inst >= CONFIG_TRACE_START) &&
-         (g_nr_guest_inst <= CONFIG_TRACE_END), false);
+  return MUXDEF(CONFIG_TRACE, (g_nr_guest_inst >= g_trace_start) &&
+         (g_nr_guest_inst <= g_trace_end), false);
+}
+
+// whether the instruction at `pc', which is being executed, is in the trace
+// window; used by the tracers which are called during the execution
+bool trace_window(vaddr_t pc) {
+  // g_nr_guest_inst is increased after the instruction is executed
+  return MUXDEF(CONFIG_TRACE, (g_nr_guest_inst + 1 >= g_trace_start) &&
+         (g_nr_guest_inst + 1 <= g_trace_end) &&
+         (!g_trace_pc_filter || (pc >= g_trace_pc_lo && pc < g_trace_pc_hi)), true);
 }
 #endif
@@ -0,0 +1,186 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <memory/vaddr.h>
+#include <device/alarm.h>
+#include <signal.h>
+
+// Guest pc sampling profiler. The execution loop decrements the countdown
+// after every instruction and calls pcsample() when it reaches zero. In the
+// timer mode, the alarm, which runs in a signal handler, sets a flag
+// instead, and the execution loop takes a sample when the flag is set.
+
+#define NR_TOP_PC 20
+#define NR_TOP_RANGE 10
+#define RANGE_GAP 32   // sampled pcs closer than this are in the same range
+
+#ifdef CONFIG_PCSAMPLE_BY_INST
+uint64_t pcsample_countdown = CONFIG_PCSAMPLE_INTERVAL;
+#else
+volatile sig_atomic_t pcsample_pending = false;
+#endif
+
+typedef struct {
+  vaddr_t pc;
+  uint64_t count;  // 0 means empty
+} Sample;
+
+static Sample *table = NULL;
+static uint32_t table_size = 0;
+static uint32_t nr_pc = 0;
+static uint64_t nr_sample = 0;
+
+static inline uint32_t hash(vaddr_t pc) {
+  return ((uint64_t)pc * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+static Sample *find(Sample *t, uint32_t size, vaddr_t pc) {
+  uint32_t h = hash(pc) & (size - 1);
+  while (t[h].count != 0 && t[h].pc != pc) h = (h + 1) & (size - 1);
+  return &t[h];
+}
+
+static void grow() {
+  uint32_t new_size = table_size * 2;
+  Sample *t = calloc(new_size, sizeof(Sample));
+  assert(t);
+  uint32_t i;
+  for (i = 0; i < table_size; i ++) {
+    if (table[i].count != 0) *find(t, new_size, table[i].pc) = table[i];
+  }
+  free(table);
+  table = t;
+  table_size = new_size;
+}
+
+void pcsample(vaddr_t pc) {
+  MUXDEF(CONFIG_PCSAMPLE_BY_INST, pcsample_countdown = CONFIG_PCSAMPLE_INTERVAL, pcsample_pending = false);
+  nr_sample ++;
+  Sample *e = find(table, table_size, pc);
+  if (e->count == 0) {
+    e->pc = pc;
+    if (++ nr_pc * 2 > table_size) {
+      e->count = 1;
+      grow();
+      return;
+    }
+  }
+  e->count ++;
+}
+
+#ifdef CONFIG_PCSAMPLE_BY_TIMER
+static void pcsample_tick() {
+  pcsample_pending = true;
+}
+#endif
+
+// ----------- report -----------
+
+typedef struct {
+  vaddr_t lo, hi;
+  uint64_t count;
+} Range;
+
+static int count_cmp(const void *a, const void *b) {
+  uint64_t x = ((Sample *)a)->count, y = ((Sample *)b)->count;
+  return (x < y) - (x > y);
+}
+
+static int pc_cmp(const void *a, const void *b) {
+  vaddr_t x = ((Sample *)a)->pc, y = ((Sample *)b)->pc;
+  return (x > y) - (x < y);
+}
+
+static int range_cmp(const void *a, const void *b) {
+  uint64_t x = ((Range *)a)->count, y = ((Range *)b)->count;
+  return (x < y) - (x > y);
+}
+
+static void symbolize(char *buf, int size, vaddr_t pc) {
+  int idx = elf_func_index(pc);
+  if (idx < 0) buf[0] = '\0';
+  else snprintf(buf, size, "<%s+0x%x>", elf_func_name(idx), (uint32_t)(pc - elf_func_addr(idx)));
+}
+
+static void disasm(char *buf, int size, vaddr_t pc) {
+#ifdef CONFIG_ISA_x86
+  // the length of the instruction is unknown
+  buf[0] = '\0';
+#else
+  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+  uint32_t inst = vaddr_ifetch(pc, 4);
+  disassemble(buf, size, pc, (uint8_t *)&inst, 4);
+#endif
+}
+
+static void pcsample_report() {
+  if (nr_sample == 0) return;
+
+  Sample *s = malloc(sizeof(Sample) * nr_pc);
+  assert(s);
+  uint32_t i, n = 0;
+  for (i = 0; i < table_size; i ++) {
+    if (table[i].count != 0) s[n ++] = table[i];
+  }
+
+  char sym[64], buf[64];
+  _Log("PC sampling profile: %" PRIu64 " samples, " MUXDEF(CONFIG_PCSAMPLE_BY_INST,
+      "one every %d instructions", "one every timer tick (%d Hz)") "\n",
+      nr_sample, MUXDEF(CONFIG_PCSAMPLE_BY_INST, CONFIG_PCSAMPLE_INTERVAL, TIMER_HZ));
+
+  qsort(s, n, sizeof(Sample), count_cmp);
+  _Log("Hottest pcs:\n");
+  for (i = 0; i < n && i < NR_TOP_PC; i ++) {
+    symbolize(sym, sizeof(sym), s[i].pc);
+    disasm(buf, sizeof(buf), s[i].pc);
+    _Log("%6.2f%% %10" PRIu64 "  " FMT_WORD " %-24s %s\n", s[i].count * 100.0 / nr_sample,
+        s[i].count, s[i].pc, sym, buf);
+  }
+
+  // merge nearby pcs in the same function into ranges
+  qsort(s, n, sizeof(Sample), pc_cmp);
+  Range *r = malloc(sizeof(Range) * n);
+  assert(r);
+  uint32_t nr_range = 0;
+  int last_func = -1;
+  for (i = 0; i < n; i ++) {
+    int func = elf_func_index(s[i].pc);
+    bool same_func = (func == last_func);
+    last_func = func;
+    if (nr_range > 0 && same_func && s[i].pc - r[nr_range - 1].hi <= RANGE_GAP) {
+      r[nr_range - 1].hi = s[i].pc;
+      r[nr_range - 1].count += s[i].count;
+    } else r[nr_range ++] = (Range) { .lo = s[i].pc, .hi = s[i].pc, .count = s[i].count };
+  }
+  qsort(r, nr_range, sizeof(Range), range_cmp);
+  _Log("Hottest address ranges:\n");
+  for (i = 0; i < nr_range && i < NR_TOP_RANGE; i ++) {
+    symbolize(sym, sizeof(sym), r[i].lo);
+    _Log("%6.2f%% %10" PRIu64 "  [" FMT_WORD ", " FMT_WORD "] %s\n", r[i].count * 100.0 / nr_sample,
+        r[i].count, r[i].lo, r[i].hi, sym);
+  }
+
+  free(r);
+  free(s);
+}
+
+void init_pcsample() {
+  table_size = 4096;
+  table = calloc(table_size, sizeof(Sample));
+  assert(table);
+  IFDEF(CONFIG_PCSAMPLE_BY_TIMER, add_alarm_handle(pcsample_tick));
+  atexit(pcsample_report);
+}
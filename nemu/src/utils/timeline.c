@@ -0,0 +1,194 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* Timeline exporter. Events are written in the Chrome trace event format,
+ * which can be opened by chrome://tracing and https://ui.perfetto.dev.
+ * Every category has its own single-producer single-consumer ring. The
+ * emulator only fills the rings, and a writer thread formats the events
+ * and writes them to the file. When a ring is full, the emulator waits
+ * for the writer, so no event is lost.
+ */
+
+extern uint64_t g_nr_guest_inst;
+
+enum { CAT_FUNC, CAT_MMIO, CAT_INTR, CAT_VGA, CAT_CPU, NR_CAT };
+static const char *cat_name[] = { "function", "mmio", "interrupt", "vga", "cpu_exec" };
+
+// MMIO accesses to the same device closer than this are merged into a burst
+#define BURST_GAP MUXDEF(CONFIG_TIMELINE_CLOCK_INST, 1000, 100)
+
+typedef struct {
+  uint64_t ts, dur;
+  const char *name;
+  char ph;
+  uint64_t arg0, arg1;
+} TLEvent;
+
+typedef struct {
+  TLEvent buf[CONFIG_TIMELINE_RING_SIZE];
+  uint64_t head;  // written by the emulator
+  uint64_t tail;  // written by the writer thread
+} Ring;
+
+static Ring *ring = NULL;
+static FILE *fp = NULL;
+static pthread_t writer;
+static bool stop = false;
+static bool first_event = true;
+static uint64_t nr_wait = 0;
+
+static inline uint64_t now() {
+  return MUXDEF(CONFIG_TIMELINE_CLOCK_INST, g_nr_guest_inst, get_time());
+}
+
+static void push(int cat, TLEvent *e) {
+  Ring *r = &ring[cat];
+  uint64_t h = r->head;
+  if (h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == CONFIG_TIMELINE_RING_SIZE) {
+    nr_wait ++;
+    do { sched_yield(); }
+    while (h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == CONFIG_TIMELINE_RING_SIZE);
+  }
+  r->buf[h % CONFIG_TIMELINE_RING_SIZE] = *e;
+  __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+// ----------- event sources -----------
+
+void timeline_func(bool is_call, const char *name) {
+  TLEvent e = { .ts = now(), .name = name, .ph = (is_call ? 'B' : 'E') };
+  push(CAT_FUNC, &e);
+}
+
+static struct {
+  const char *dev;
+  uint64_t start, last, nr, bytes;
+} burst = {};
+
+static void burst_flush() {
+  if (burst.nr == 0) return;
+  TLEvent e = { .ts = burst.start, .dur = burst.last - burst.start + 1, .name = burst.dev,
+    .ph = 'X', .arg0 = burst.nr, .arg1 = burst.bytes };
+  push(CAT_MMIO, &e);
+  burst.nr = 0;
+}
+
+void timeline_mmio(const char *dev, int len) {
+  uint64_t t = now();
+  if (burst.nr != 0 && (burst.dev != dev || t - burst.last > BURST_GAP)) burst_flush();
+  if (burst.nr == 0) {
+    burst.dev = dev;
+    burst.start = t;
+    burst.bytes = 0;
+  }
+  burst.last = t;
+  burst.nr ++;
+  burst.bytes += len;
+}
+
+void timeline_intr(word_t NO, vaddr_t epc) {
+  TLEvent e = { .ts = now(), .name = "trap", .ph = 'i', .arg0 = NO, .arg1 = epc };
+  push(CAT_INTR, &e);
+}
+
+void timeline_vga_sync() {
+  TLEvent e = { .ts = now(), .name = "sync", .ph = 'i' };
+  push(CAT_VGA, &e);
+}
+
+// called before and after a batch of instructions executed by cpu_exec()
+void timeline_cpu_exec(bool is_start, uint64_t n) {
+  static uint64_t start = 0;
+  if (is_start) { start = now(); return; }
+  uint64_t t = now();
+  TLEvent e = { .ts = start, .dur = (t == start ? 1 : t - start), .name = "cpu_exec",
+    .ph = 'X', .arg0 = n };
+  push(CAT_CPU, &e);
+}
+
+// ----------- writer -----------
+
+static void write_event(int cat, TLEvent *e) {
+  fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ",\"pid\":1,\"tid\":%d",
+      (first_event ? "" : ",\n"), e->name, cat_name[cat], e->ph, e->ts, cat + 1);
+  first_event = false;
+  if (e->ph == 'X') fprintf(fp, ",\"dur\":%" PRIu64, e->dur);
+  if (e->ph == 'i') fprintf(fp, ",\"s\":\"t\"");
+  switch (cat) {
+    case CAT_MMIO: fprintf(fp, ",\"args\":{\"accesses\":%" PRIu64 ",\"bytes\":%" PRIu64 "}", e->arg0, e->arg1); break;
+    case CAT_INTR: fprintf(fp, ",\"args\":{\"cause\":\"0x%" PRIx64 "\",\"epc\":\"0x%" PRIx64 "\"}", e->arg0, e->arg1); break;
+    case CAT_CPU:  fprintf(fp, ",\"args\":{\"n\":%" PRIu64 "}", e->arg0); break;
+  }
+  fputc('}', fp);
+}
+
+static bool drain() {
+  bool busy = false;
+  int c;
+  for (c = 0; c < NR_CAT; c ++) {
+    Ring *r = &ring[c];
+    uint64_t t = r->tail;
+    uint64_t h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    for (; t != h; t ++) write_event(c, &r->buf[t % CONFIG_TIMELINE_RING_SIZE]);
+    if (r->tail != h) busy = true;
+    __atomic_store_n(&r->tail, h, __ATOMIC_RELEASE);
+  }
+  return busy;
+}
+
+static void *writer_thread(void *arg) {
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+    if (!drain()) usleep(1000);
+  }
+  drain();
+  return NULL;
+}
+
+static void timeline_close() {
+  burst_flush();
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  pthread_join(writer, NULL);
+  fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  fclose(fp);
+  Log("Timeline is written to %s", CONFIG_TIMELINE_FILE);
+  if (nr_wait > 0) Log("The emulator waited %" PRIu64 " times for the timeline writer", nr_wait);
+}
+
+void init_timeline() {
+  fp = fopen(CONFIG_TIMELINE_FILE, "w");
+  Assert(fp, "Can not open '%s'", CONFIG_TIMELINE_FILE);
+  setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+  ring = calloc(NR_CAT, sizeof(Ring));
+  assert(ring);
+
+  fprintf(fp, "{\"traceEvents\":[\n");
+  int c;
+  for (c = 0; c < NR_CAT; c ++) {
+    fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+        (first_event ? "" : ",\n"), c + 1, cat_name[c]);
+    first_event = false;
+  }
+
+  int ret = pthread_create(&writer, NULL, writer_thread, NULL);
+  Assert(ret == 0, "Can not create the timeline writer thread");
+  atexit(timeline_close);
+  Log("Timeline (%s) is written to %s",
+      MUXDEF(CONFIG_TIMELINE_CLOCK_INST, "1 us = 1 guest instruction", "host time"), CONFIG_TIMELINE_FILE);
+}
@@ -14,10 +14,13 @@
 #**************************************************************************************/
 
 ifdef CONFIG_DIFFTEST
+COMMA := ,
 DIFF_REF_PATH = $(NEMU_HOME)/$(call remove_quote,$(CONFIG_DIFFTEST_REF_PATH))
 DIFF_REF_SO = $(DIFF_REF_PATH)/build/$(GUEST_ISA)-$(call remove_quote,$(CONFIG_DIFFTEST_REF_NAME))-so
 MKFLAGS = GUEST_ISA=$(GUEST_ISA) SHARE=1 ENGINE=interpreter
 ARGS_DIFF = --diff=$(DIFF_REF_SO)
+DIFF_REF_EXTRA = $(subst $(COMMA), ,$(call remove_quote,$(CONFIG_DIFFTEST_REF_EXTRA)))
+ARGS_DIFF += $(addprefix --diff=,$(DIFF_REF_EXTRA))
 
 ifndef CONFIG_DIFFTEST_REF_NEMU
 $(DIFF_REF_SO):
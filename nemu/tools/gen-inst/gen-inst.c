@@ -0,0 +1,620 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Generate random riscv32 instruction sequences and run them on DUT and
+// REF through the difftest API. Both DUT (NEMU built with TARGET_SHARE)
+// and REF are loaded once, and the state is reset by memcpy/regcpy
+// between test cases. Each case is generated from (seed, case id), so a
+// failing case can be regenerated and shrunk to a minimal reproducer.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <difftest-def.h>
+
+#if !defined(CONFIG_ISA_riscv) || defined(CONFIG_RV64) || defined(CONFIG_RVE)
+#error gen-inst only supports riscv32
+#endif
+
+#define CODE_BASE (CONFIG_MBASE + CONFIG_PC_RESET_OFFSET)
+#define DATA_BASE (CODE_BASE + 0x100000)
+#define DATA_SIZE 2048 // reachable by a 12-bit offset from BASE_REG
+#define NR_GPR 32
+#define BASE_REG 31    // holds DATA_BASE and is never written
+#define MAX_LEN 1024
+#define MAX_JOB 256
+#define MAX_FORWARD 32 // max distance of a jump, in instructions
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define NOP 0x00000013 // addi zero, zero, 0
+#define END 0x0000006f // jal zero, 0, placed right after the program
+
+typedef struct {
+  uint32_t gpr[NR_GPR];
+  uint32_t pc;
+} State;
+
+typedef struct {
+  const char *name;
+  void (*copy_mem)(uint32_t addr, void *buf, size_t n, bool direction);
+  void (*copy_reg)(void *dut, bool direction);
+  void (*exec)(uint64_t n);
+  void (*init)(int port);
+} Sim;
+
+static Sim dut, ref;
+
+typedef struct {
+  uint32_t inst;
+  int size; // instructions starting from here which should be shrunk together
+  char text[40];
+} Inst;
+
+typedef struct {
+  uint64_t id;
+  int len;
+  Inst code[MAX_LEN];
+  uint32_t gpr[NR_GPR];
+  uint8_t data[DATA_SIZE];
+} Case;
+
+// ----------- random instruction generation -----------
+
+enum { TYPE_R, TYPE_I, TYPE_SHAMT, TYPE_LOAD, TYPE_STORE, TYPE_B, TYPE_LUI, TYPE_AUIPC, TYPE_JAL, TYPE_JALR };
+
+typedef struct {
+  const char *name;
+  int type;
+  uint32_t funct7, funct3, opcode;
+  int width; // for loads and stores
+  bool disabled;
+} InstDef;
+
+static InstDef table[] = {
+  { "lui"   , TYPE_LUI  , 0, 0, 0x37 },
+  { "auipc" , TYPE_AUIPC, 0, 0, 0x17 },
+  { "jal"   , TYPE_JAL  , 0, 0, 0x6f },
+  { "jalr"  , TYPE_JALR , 0, 0, 0x67 },
+  { "beq"   , TYPE_B    , 0, 0, 0x63 },
+  { "bne"   , TYPE_B    , 0, 1, 0x63 },
+  { "blt"   , TYPE_B    , 0, 4, 0x63 },
+  { "bge"   , TYPE_B    , 0, 5, 0x63 },
+  { "bltu"  , TYPE_B    , 0, 6, 0x63 },
+  { "bgeu"  , TYPE_B    , 0, 7, 0x63 },
+  { "lb"    , TYPE_LOAD , 0, 0, 0x03, 1 },
+  { "lh"    , TYPE_LOAD , 0, 1, 0x03, 2 },
+  { "lw"    , TYPE_LOAD , 0, 2, 0x03, 4 },
+  { "lbu"   , TYPE_LOAD , 0, 4, 0x03, 1 },
+  { "lhu"   , TYPE_LOAD , 0, 5, 0x03, 2 },
+  { "sb"    , TYPE_STORE, 0, 0, 0x23, 1 },
+  { "sh"    , TYPE_STORE, 0, 1, 0x23, 2 },
+  { "sw"    , TYPE_STORE, 0, 2, 0x23, 4 },
+  { "addi"  , TYPE_I    , 0, 0, 0x13 },
+  { "slti"  , TYPE_I    , 0, 2, 0x13 },
+  { "sltiu" , TYPE_I    , 0, 3, 0x13 },
+  { "xori"  , TYPE_I    , 0, 4, 0x13 },
+  { "ori"   , TYPE_I    , 0, 6, 0x13 },
+  { "andi"  , TYPE_I    , 0, 7, 0x13 },
+  { "slli"  , TYPE_SHAMT, 0x00, 1, 0x13 },
+  { "srli"  , TYPE_SHAMT, 0x00, 5, 0x13 },
+  { "srai"  , TYPE_SHAMT, 0x20, 5, 0x13 },
+  { "add"   , TYPE_R    , 0x00, 0, 0x33 },
+  { "sub"   , TYPE_R    , 0x20, 0, 0x33 },
+  { "sll"   , TYPE_R    , 0x00, 1, 0x33 },
+  { "slt"   , TYPE_R    , 0x00, 2, 0x33 },
+  { "sltu"  , TYPE_R    , 0x00, 3, 0x33 },
+  { "xor"   , TYPE_R    , 0x00, 4, 0x33 },
+  { "srl"   , TYPE_R    , 0x00, 5, 0x33 },
+  { "sra"   , TYPE_R    , 0x20, 5, 0x33 },
+  { "or"    , TYPE_R    , 0x00, 6, 0x33 },
+  { "and"   , TYPE_R    , 0x00, 7, 0x33 },
+  { "mul"   , TYPE_R    , 0x01, 0, 0x33 },
+  { "mulh"  , TYPE_R    , 0x01, 1, 0x33 },
+  { "mulhsu", TYPE_R    , 0x01, 2, 0x33 },
+  { "mulhu" , TYPE_R    , 0x01, 3, 0x33 },
+  { "div"   , TYPE_R    , 0x01, 4, 0x33 },
+  { "divu"  , TYPE_R    , 0x01, 5, 0x33 },
+  { "rem"   , TYPE_R    , 0x01, 6, 0x33 },
+  { "remu"  , TYPE_R    , 0x01, 7, 0x33 },
+};
+
+static const char *regs[] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+static uint64_t rng = 0;
+
+// splitmix64
+static uint64_t rand64() {
+  uint64_t z = (rng += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static uint32_t choose(uint32_t n) {
+  return rand64() % n;
+}
+
+static uint32_t rand_value() {
+  static const uint32_t special[] = { 0, 1, 2, -1, -2, 31, 32, 0x7fffffff, 0x80000000, 0x80000001 };
+  switch (choose(4)) {
+    case 0: return special[choose(ARRLEN(special))];
+    case 1: return choose(64) - 32;
+    default: return rand64();
+  }
+}
+
+static int32_t rand_imm12() {
+  static const int32_t special[] = { 0, 1, -1, 2047, -2048 };
+  switch (choose(3)) {
+    case 0: return special[choose(ARRLEN(special))];
+    case 1: return (int32_t)choose(33) - 16;
+    default: return (int32_t)choose(4096) - 2048;
+  }
+}
+
+static int rand_rd() { return choose(BASE_REG); }
+static int rand_rs() { return choose(NR_GPR); }
+
+static uint32_t enc_r(InstDef *d, int rd, int rs1, int rs2) {
+  return (d->funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (d->funct3 << 12) | (rd << 7) | d->opcode;
+}
+
+static uint32_t enc_i(InstDef *d, int rd, int rs1, int32_t imm) {
+  return ((imm & 0xfff) << 20) | (rs1 << 15) | (d->funct3 << 12) | (rd << 7) | d->opcode;
+}
+
+static uint32_t enc_s(InstDef *d, int rs1, int rs2, int32_t imm) {
+  return (BITS(imm, 11, 5) << 25) | (rs2 << 20) | (rs1 << 15) | (d->funct3 << 12) |
+    (BITS(imm, 4, 0) << 7) | d->opcode;
+}
+
+static uint32_t enc_b(InstDef *d, int rs1, int rs2, int32_t imm) {
+  return (BITS(imm, 12, 12) << 31) | (BITS(imm, 10, 5) << 25) | (rs2 << 20) | (rs1 << 15) |
+    (d->funct3 << 12) | (BITS(imm, 4, 1) << 8) | (BITS(imm, 11, 11) << 7) | d->opcode;
+}
+
+static uint32_t enc_u(InstDef *d, int rd, uint32_t imm20) {
+  return (imm20 << 12) | (rd << 7) | d->opcode;
+}
+
+static uint32_t enc_j(InstDef *d, int rd, int32_t imm) {
+  return (BITS(imm, 20, 20) << 31) | (BITS(imm, 10, 1) << 21) | (BITS(imm, 11, 11) << 20) |
+    (BITS(imm, 19, 12) << 12) | (rd << 7) | d->opcode;
+}
+
+static void set_nop(Inst *p) {
+  p->inst = NOP;
+  p->size = 1;
+  strcpy(p->text, "nop");
+}
+
+// Pick a forward jump target in [from + 1, len], where code[len] is END.
+// The program is generated backwards, so the target is known not to be
+// the second half of an instruction pair.
+static int rand_target(Case *c, int from) {
+  int t;
+  do {
+    t = from + 1 + choose(MIN(c->len - from, MAX_FORWARD));
+  } while (t < c->len && c->code[t].size == 0);
+  return t;
+}
+
+// Generate the instruction(s) ending at code[idx], return the number of slots used.
+static int gen_inst(Case *c, int idx) {
+  Inst *p = &c->code[idx];
+  InstDef *d;
+  do {
+    d = &table[choose(ARRLEN(table))];
+  } while (d->disabled || (d->type == TYPE_JALR && idx == 0));
+
+  int rd = rand_rd(), rs1 = rand_rs(), rs2 = rand_rs();
+  int32_t imm;
+  p->size = 1;
+  switch (d->type) {
+    case TYPE_R:
+      p->inst = enc_r(d, rd, rs1, rs2);
+      sprintf(p->text, "%s %s, %s, %s", d->name, regs[rd], regs[rs1], regs[rs2]);
+      break;
+    case TYPE_I:
+      imm = rand_imm12();
+      p->inst = enc_i(d, rd, rs1, imm);
+      sprintf(p->text, "%s %s, %s, %d", d->name, regs[rd], regs[rs1], imm);
+      break;
+    case TYPE_SHAMT:
+      imm = choose(32);
+      p->inst = enc_i(d, rd, rs1, imm) | (d->funct7 << 25);
+      sprintf(p->text, "%s %s, %s, %d", d->name, regs[rd], regs[rs1], imm);
+      break;
+    case TYPE_LOAD:
+      imm = choose(DATA_SIZE / d->width) * d->width;
+      p->inst = enc_i(d, rd, BASE_REG, imm);
+      sprintf(p->text, "%s %s, %d(%s)", d->name, regs[rd], imm, regs[BASE_REG]);
+      break;
+    case TYPE_STORE:
+      imm = choose(DATA_SIZE / d->width) * d->width;
+      p->inst = enc_s(d, BASE_REG, rs2, imm);
+      sprintf(p->text, "%s %s, %d(%s)", d->name, regs[rs2], imm, regs[BASE_REG]);
+      break;
+    case TYPE_B:
+      imm = (rand_target(c, idx) - idx) * 4;
+      p->inst = enc_b(d, rs1, rs2, imm);
+      sprintf(p->text, "%s %s, %s, .+%d", d->name, regs[rs1], regs[rs2], imm);
+      break;
+    case TYPE_LUI:
+    case TYPE_AUIPC:
+      imm = rand_value() & 0xfffff;
+      p->inst = enc_u(d, rd, imm);
+      sprintf(p->text, "%s %s, 0x%x", d->name, regs[rd], imm);
+      break;
+    case TYPE_JAL:
+      imm = (rand_target(c, idx) - idx) * 4;
+      p->inst = enc_j(d, rd, imm);
+      sprintf(p->text, "%s %s, .+%d", d->name, regs[rd], imm);
+      break;
+    case TYPE_JALR: {
+      // auipc t, 0; jalr rd, off(t)
+      // off is relative to the auipc, the lowest bit of the target is ignored
+      int t = 1 + choose(BASE_REG - 1);
+      imm = (rand_target(c, idx) - (idx - 1)) * 4 + choose(2);
+      p[-1].inst = (t << 7) | 0x17;
+      p[-1].size = 2;
+      sprintf(p[-1].text, "auipc %s, 0x0", regs[t]);
+      p->inst = enc_i(d, rd, t, imm);
+      p->size = 0;
+      sprintf(p->text, "jalr %s, %d(%s)", regs[rd], imm, regs[t]);
+      return 2;
+    }
+    default: assert(0);
+  }
+  return 1;
+}
+
+static void gen_case(Case *c, uint64_t seed, uint64_t id, int len) {
+  rng = seed ^ (id * 0xd1b54a32d192ed03ull);
+  c->id = id;
+  c->len = len;
+  int i;
+  for (i = len - 1; i >= 0; ) {
+    i -= gen_inst(c, i);
+  }
+  c->gpr[0] = 0;
+  for (i = 1; i < NR_GPR; i ++) {
+    c->gpr[i] = rand_value();
+  }
+  c->gpr[BASE_REG] = DATA_BASE;
+  for (i = 0; i < DATA_SIZE; i += 8) {
+    uint64_t v = rand64();
+    memcpy(&c->data[i], &v, 8);
+  }
+}
+
+// ----------- running a case on DUT and REF -----------
+
+#define END_PC(c) (CODE_BASE + (c)->len * 4)
+
+static void reset(Sim *s, Case *c) {
+  static uint32_t code[MAX_LEN + 1];
+  int i;
+  for (i = 0; i < c->len; i ++) {
+    code[i] = c->code[i].inst;
+  }
+  code[c->len] = END;
+  s->copy_mem(CODE_BASE, code, (c->len + 1) * 4, DIFFTEST_TO_REF);
+  s->copy_mem(DATA_BASE, c->data, DATA_SIZE, DIFFTEST_TO_REF);
+
+  State st;
+  memcpy(st.gpr, c->gpr, sizeof(st.gpr));
+  st.pc = CODE_BASE;
+  s->copy_reg(&st, DIFFTEST_TO_REF);
+}
+
+static void report_state_diff(uint32_t pc, State *d, State *r) {
+  printf("after executing the instruction at pc = 0x%08x:\n", pc);
+  int i;
+  for (i = 0; i < NR_GPR; i ++) {
+    if (d->gpr[i] != r->gpr[i]) {
+      printf("  %-4s: ref = 0x%08x, dut = 0x%08x\n", regs[i], r->gpr[i], d->gpr[i]);
+    }
+  }
+  if (d->pc != r->pc) {
+    printf("  pc  : ref = 0x%08x, dut = 0x%08x\n", r->pc, d->pc);
+  }
+}
+
+// Return true if DUT and REF agree on this case.
+static bool run_case(Case *c, bool verbose) {
+  State d, r;
+  uint32_t pc = CODE_BASE;
+  int step;
+  reset(&dut, c);
+  reset(&ref, c);
+
+  for (step = 0; step <= c->len; step ++) {
+    dut.exec(1);
+    ref.exec(1);
+    dut.copy_reg(&d, DIFFTEST_TO_DUT);
+    ref.copy_reg(&r, DIFFTEST_TO_DUT);
+    if (memcmp(&d, &r, sizeof(State)) != 0) {
+      if (verbose) report_state_diff(pc, &d, &r);
+      return false;
+    }
+    if (d.pc == pc) break; // stuck, e.g. DUT stops after an invalid instruction
+    pc = d.pc;
+    if (pc == END_PC(c)) break;
+    if (pc < CODE_BASE || pc > END_PC(c)) {
+      if (verbose) printf("both leave the program at pc = 0x%08x\n", pc);
+      return false;
+    }
+  }
+  if (pc != END_PC(c)) {
+    if (verbose) printf("the end of the program is not reached, stuck at pc = 0x%08x\n", pc);
+    return false;
+  }
+
+  static uint8_t dbuf[DATA_SIZE], rbuf[DATA_SIZE];
+  dut.copy_mem(DATA_BASE, dbuf, DATA_SIZE, DIFFTEST_TO_DUT);
+  ref.copy_mem(DATA_BASE, rbuf, DATA_SIZE, DIFFTEST_TO_DUT);
+  if (memcmp(dbuf, rbuf, DATA_SIZE) != 0) {
+    if (verbose) {
+      int i;
+      for (i = 0; i < DATA_SIZE && dbuf[i] == rbuf[i]; i ++);
+      printf("memory is different at 0x%08x: ref = 0x%02x, dut = 0x%02x\n",
+          DATA_BASE + i, rbuf[i], dbuf[i]);
+    }
+    return false;
+  }
+  return true;
+}
+
+// Run the case in a child process, so that a DUT which crashes or can
+// not be reset any more (e.g. after an invalid instruction) is thrown away.
+static bool fails(Case *c, bool verbose) {
+  fflush(stdout);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    if (!verbose) assert(freopen("/dev/null", "w", stdout) != NULL);
+    exit(run_case(c, verbose) ? 0 : 1);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (verbose && WIFSIGNALED(status)) printf("DUT or REF is killed by signal %d\n", WTERMSIG(status));
+  return !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// Replace instructions with nop and clear registers as long as the case still fails.
+static void shrink(Case *c) {
+  bool progress = true;
+  int i, nr_try = 0;
+  while (progress) {
+    progress = false;
+    for (i = 0; i < c->len; i ++) {
+      int n = c->code[i].size;
+      if (n == 0 || c->code[i].inst == NOP) continue;
+      Inst save[2];
+      memcpy(save, &c->code[i], sizeof(Inst) * n);
+      int j;
+      for (j = 0; j < n; j ++) set_nop(&c->code[i + j]);
+      nr_try ++;
+      if (fails(c, false)) progress = true;
+      else memcpy(&c->code[i], save, sizeof(Inst) * n);
+    }
+    for (i = 1; i < BASE_REG; i ++) {
+      if (c->gpr[i] == 0) continue;
+      uint32_t save = c->gpr[i];
+      c->gpr[i] = 0;
+      nr_try ++;
+      if (fails(c, false)) progress = true;
+      else c->gpr[i] = save;
+    }
+  }
+  printf("shrunk with %d tries\n", nr_try);
+}
+
+static void report(Case *c, uint64_t seed) {
+  int i;
+  printf("reproducer (seed = 0x%lx, case = %lu):\n", seed, c->id);
+  for (i = 0; i < c->len; i ++) {
+    if (c->code[i].inst == NOP) continue;
+    printf("  0x%08x: %08x  %s\n", CODE_BASE + i * 4, c->code[i].inst, c->code[i].text);
+  }
+  printf("  0x%08x: %08x  (end)\n", END_PC(c), END);
+  printf("initial registers (others are zero):\n");
+  for (i = 1; i < NR_GPR; i ++) {
+    if (c->gpr[i] != 0) printf("  %-4s = 0x%08x\n", regs[i], c->gpr[i]);
+  }
+  fails(c, true);
+}
+
+// ----------- driver -----------
+
+typedef struct {
+  volatile int stop;
+  uint64_t cur[MAX_JOB];     // the case being run by each worker
+  uint64_t nr_done[MAX_JOB];
+} Shared;
+
+static Shared *shm = NULL;
+
+static void worker(int w, int nr_job, uint64_t seed, uint64_t nr_case, int len) {
+  static Case c;
+  uint64_t id;
+  assert(freopen("/dev/null", "w", stdout) != NULL);
+  for (id = w; id < nr_case && !shm->stop; id += nr_job) {
+    shm->cur[w] = id;
+    gen_case(&c, seed, id, len);
+    // The DUT may be left in a state which can not be reset.
+    // Stop here and let the main process shrink the case.
+    if (!run_case(&c, false)) exit(1);
+    shm->nr_done[w] ++;
+  }
+  exit(0);
+}
+
+static void load(Sim *s, const char *so, bool new_namespace) {
+  // load the same .so again in a new namespace to get a separate instance
+  void *handle = (new_namespace ? dlmopen(LM_ID_NEWLM, so, RTLD_LAZY) : dlopen(so, RTLD_LAZY));
+  if (handle == NULL) {
+    fprintf(stderr, "can not load %s: %s\n", so, dlerror());
+    exit(1);
+  }
+  s->name = so;
+  s->copy_mem = dlsym(handle, "difftest_memcpy");
+  assert(s->copy_mem);
+  s->copy_reg = dlsym(handle, "difftest_regcpy");
+  assert(s->copy_reg);
+  s->exec = dlsym(handle, "difftest_exec");
+  assert(s->exec);
+  s->init = dlsym(handle, "difftest_init");
+  assert(s->init);
+}
+
+static void exclude(char *list) {
+  char *name;
+  for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+    int i;
+    for (i = 0; i < ARRLEN(table); i ++) {
+      if (strcmp(table[i].name, name) == 0) break;
+    }
+    if (i == ARRLEN(table)) {
+      fprintf(stderr, "unknown instruction '%s'\n", name);
+      exit(1);
+    }
+    table[i].disabled = true;
+  }
+  int i;
+  for (i = 0; i < ARRLEN(table); i ++) {
+    if (!table[i].disabled && table[i].type != TYPE_JALR) return;
+  }
+  fprintf(stderr, "all instructions are excluded\n");
+  exit(1);
+}
+
+static void usage(const char *prog) {
+  printf("Usage: %s [OPTION...] DUT_SO REF_SO\n\n", prog);
+  printf("\t-n,--cases=N            run N random cases (default 100000)\n");
+  printf("\t-l,--len=N              generate N instructions per case (default 32)\n");
+  printf("\t-j,--jobs=N             run N worker processes (default: number of cores)\n");
+  printf("\t-s,--seed=SEED          use SEED to generate cases (default: time)\n");
+  printf("\t-c,--case=ID            only run the case ID\n");
+  printf("\t-x,--exclude=INST,...   do not generate these instructions\n");
+  printf("\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t nr_case = 100000, seed = time(NULL), only = UINT64_MAX;
+  int len = 32, nr_job = sysconf(_SC_NPROCESSORS_ONLN);
+  const struct option opts[] = {
+    {"cases"  , required_argument, NULL, 'n'},
+    {"len"    , required_argument, NULL, 'l'},
+    {"jobs"   , required_argument, NULL, 'j'},
+    {"seed"   , required_argument, NULL, 's'},
+    {"case"   , required_argument, NULL, 'c'},
+    {"exclude", required_argument, NULL, 'x'},
+    {"help"   , no_argument      , NULL, 'h'},
+    {0        , 0                , NULL,  0 },
+  };
+  int o;
+  while ( (o = getopt_long(argc, argv, "n:l:j:s:c:x:h", opts, NULL)) != -1) {
+    switch (o) {
+      case 'n': nr_case = strtoull(optarg, NULL, 0); break;
+      case 'l': len = atoi(optarg); break;
+      case 'j': nr_job = atoi(optarg); break;
+      case 's': seed = strtoull(optarg, NULL, 0); break;
+      case 'c': only = strtoull(optarg, NULL, 0); break;
+      case 'x': exclude(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2) usage(argv[0]);
+  if (len < 1 || len >= MAX_LEN) { fprintf(stderr, "len should be in [1, %d)\n", MAX_LEN); return 1; }
+  nr_job = MAX(1, MIN(nr_job, MAX_JOB));
+  assert(sizeof(State) == DIFFTEST_REG_SIZE);
+
+  load(&dut, argv[optind], false);
+  load(&ref, argv[optind + 1], strcmp(argv[optind], argv[optind + 1]) == 0);
+  dut.init(1234);
+  ref.init(1235);
+
+  static Case c;
+  if (only != UINT64_MAX) {
+    gen_case(&c, seed, only, len);
+    if (!fails(&c, false)) {
+      printf("case %lu passed\n", only);
+      return 0;
+    }
+    shrink(&c);
+    report(&c, seed);
+    return 1;
+  }
+
+  shm = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(shm != MAP_FAILED);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  fflush(stdout);
+  int w;
+  pid_t pid[MAX_JOB];
+  for (w = 0; w < nr_job; w ++) {
+    pid[w] = fork();
+    assert(pid[w] >= 0);
+    if (pid[w] == 0) worker(w, nr_job, seed, nr_case, len);
+  }
+
+  uint64_t failed = UINT64_MAX;
+  int nr_exit;
+  for (nr_exit = 0; nr_exit < nr_job; nr_exit ++) {
+    int status;
+    pid_t p = wait(&status);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+    shm->stop = 1;
+    for (w = 0; w < nr_job; w ++) {
+      if (pid[w] == p) failed = MIN(failed, shm->cur[w]);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  uint64_t nr_done = 0;
+  for (w = 0; w < nr_job; w ++) nr_done += shm->nr_done[w];
+  double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%lu cases passed in %.2f s (%.0f cases/s, %d jobs, seed = 0x%lx)\n",
+      nr_done, sec, nr_done / sec, nr_job, seed);
+
+  if (failed == UINT64_MAX) return 0;
+  printf("case %lu failed, shrinking...\n", failed);
+  gen_case(&c, seed, failed, len);
+  shrink(&c);
+  report(&c, seed);
+  return 1;
+}
@@ -379,6 +379,24 @@ __EXPORT void difftest_regcpy(void *r, bool direction) {
   }
 }
 
+// set the `idx`-th register in the layout of x86_CPU_state
+__EXPORT void difftest_regset(int idx, uint64_t val) {
+  struct kvm_regs *ref = &(vcpu.kvm_run->s.regs.regs);
+  switch (idx) {
+    case 0: ref->rax = (uint32_t)val; break;
+    case 1: ref->rcx = (uint32_t)val; break;
+    case 2: ref->rdx = (uint32_t)val; break;
+    case 3: ref->rbx = (uint32_t)val; break;
+    case 4: ref->rsp = (uint32_t)val; break;
+    case 5: ref->rbp = (uint32_t)val; break;
+    case 6: ref->rsi = (uint32_t)val; break;
+    case 7: ref->rdi = (uint32_t)val; break;
+    case 8: ref->rip = (uint32_t)val; break;
+    default: assert(0);
+  }
+  vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+}
+
 __EXPORT void difftest_exec(uint64_t n) {
   kvm_exec(n);
 }
@@ -0,0 +1,315 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+// Decode the binary instruction trace written by NEMU with CONFIG_ITRACE_BINARY.
+// See src/utils/bintrace.c for the format.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <getopt.h>
+#include <dlfcn.h>
+#ifdef HAS_CAPSTONE
+#include <capstone/capstone.h>
+#endif
+
+#define BINTRACE_VERSION 1
+#define BINTRACE_FLAG_RD 0x1
+
+typedef struct {
+  uint64_t idx;
+  uint64_t pc;
+  int ilen;
+  uint8_t inst[16];
+  int rd;          // 0 if no value is recorded
+  uint64_t rd_val;
+} Record;
+
+static FILE *fp = NULL;
+static char isa[32] = {};
+static int flags = 0;
+static int word_size = 0;
+static bool is_riscv = false;
+
+// filters
+static uint64_t pc_lo = 0, pc_hi = UINT64_MAX;
+static uint64_t idx_lo = 0, idx_hi = UINT64_MAX;
+static const char *pattern = NULL;
+static bool has_value = false;
+static uint64_t value = 0;
+static bool count_only = false;
+
+static void read_header() {
+  uint8_t hdr[12];
+  if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) || memcmp(hdr, "NEMUTRC", 8) != 0) {
+    fprintf(stderr, "not a NEMU binary instruction trace\n");
+    exit(1);
+  }
+  if (hdr[8] != BINTRACE_VERSION) {
+    fprintf(stderr, "unsupported version %d\n", hdr[8]);
+    exit(1);
+  }
+  flags = hdr[9];
+  word_size = hdr[10];
+  int len = hdr[11];
+  assert(len < sizeof(isa));
+  assert(fread(isa, 1, len, fp) == len);
+  is_riscv = (strncmp(isa, "riscv", 5) == 0);
+}
+
+// the same rule is used by NEMU when writing the trace
+static int riscv_inst_rd(uint32_t inst) {
+  int rd = (inst >> 7) & 0x1f;
+  switch (inst & 0x7f) {
+    case 0x37: case 0x17: case 0x6f: case 0x67: // lui, auipc, jal, jalr
+    case 0x03: case 0x13: case 0x33:            // load, op-imm, op
+    case 0x1b: case 0x3b:                       // op-imm-32, op-32
+      return rd;
+    case 0x73: return (((inst >> 12) & 0x7) != 0 ? rd : 0); // csr
+    default: return 0;
+  }
+}
+
+static bool read_record(Record *r) {
+  static uint64_t expected_pc = 0, idx = 0;
+  uint64_t v = 0;
+  int shift = 0, c;
+  do {
+    c = getc(fp);
+    if (c == EOF) {
+      if (shift != 0) fprintf(stderr, "warning: the trace is truncated\n");
+      return false;
+    }
+    v |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+
+  r->ilen = v & 0xf;
+  uint64_t zz = v >> 4;
+  int64_t delta = (zz >> 1) ^ -(int64_t)(zz & 1);
+  uint64_t mask = (word_size == 8 ? UINT64_MAX : (1ull << (word_size * 8)) - 1);
+  r->pc = (expected_pc + delta) & mask;
+  r->idx = idx ++;
+  if (fread(r->inst, 1, r->ilen, fp) != r->ilen) {
+    fprintf(stderr, "warning: the trace is truncated\n");
+    return false;
+  }
+  expected_pc = r->pc + r->ilen;
+
+  r->rd = 0;
+  r->rd_val = 0;
+  if ((flags & BINTRACE_FLAG_RD) && is_riscv) {
+    uint32_t inst;
+    memcpy(&inst, r->inst, 4);
+    r->rd = riscv_inst_rd(inst);
+    if (r->rd != 0 && fread(&r->rd_val, 1, word_size, fp) != word_size) {
+      fprintf(stderr, "warning: the trace is truncated\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+// ----------- disassembler -----------
+
+#ifdef HAS_CAPSTONE
+static size_t (*cs_disasm_dl)(csh handle, const uint8_t *code,
+    size_t code_size, uint64_t address, size_t count, cs_insn **insn);
+static void (*cs_free_dl)(cs_insn *insn, size_t count);
+static csh handle;
+static bool has_disasm = false;
+#endif
+
+#ifdef HAS_RISCV32_DISASM
+void riscv32_disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+#endif
+// riscv32 falls back to the built-in disassembler (see riscv32-disasm.c)
+static bool has_builtin = false;
+
+static void init_disasm(const char *lib) {
+#ifdef HAS_RISCV32_DISASM
+  has_builtin = (strcmp(isa, "riscv32") == 0);
+#endif
+#ifdef HAS_CAPSTONE
+  void *dl_handle = dlopen(lib, RTLD_LAZY);
+  if (dl_handle == NULL) {
+    if (!has_builtin) {
+      fprintf(stderr, "warning: can not load %s, instructions are not disassembled\n", lib);
+    }
+    return;
+  }
+  cs_err (*cs_open_dl)(cs_arch arch, cs_mode mode, csh *handle) = dlsym(dl_handle, "cs_open");
+  cs_err (*cs_option_dl)(csh handle, cs_opt_type type, size_t value) = dlsym(dl_handle, "cs_option");
+  cs_disasm_dl = dlsym(dl_handle, "cs_disasm");
+  cs_free_dl = dlsym(dl_handle, "cs_free");
+  assert(cs_open_dl && cs_option_dl && cs_disasm_dl && cs_free_dl);
+
+  cs_arch arch;
+  cs_mode mode;
+  if (strcmp(isa, "x86") == 0) { arch = CS_ARCH_X86; mode = CS_MODE_32; }
+  else if (strcmp(isa, "mips32") == 0) { arch = CS_ARCH_MIPS; mode = CS_MODE_MIPS32; }
+  else if (strcmp(isa, "riscv32") == 0) { arch = CS_ARCH_RISCV; mode = CS_MODE_RISCV32 | CS_MODE_RISCVC; }
+  else if (strcmp(isa, "riscv64") == 0) { arch = CS_ARCH_RISCV; mode = CS_MODE_RISCV64 | CS_MODE_RISCVC; }
+  else if (strcmp(isa, "loongarch32r") == 0) { arch = CS_ARCH_LOONGARCH; mode = CS_MODE_LOONGARCH32; }
+  else {
+    fprintf(stderr, "warning: unknown ISA '%s', instructions are not disassembled\n", isa);
+    return;
+  }
+  int ret = cs_open_dl(arch, mode, &handle);
+  assert(ret == CS_ERR_OK);
+  if (arch == CS_ARCH_X86) cs_option_dl(handle, CS_OPT_SYNTAX, CS_OPT_SYNTAX_ATT);
+  has_disasm = true;
+#else
+  if (!has_builtin) {
+    fprintf(stderr, "warning: built without capstone, instructions are not disassembled\n");
+  }
+#endif
+}
+
+static void disassemble(char *str, int size, Record *r) {
+  str[0] = '\0';
+#ifdef HAS_CAPSTONE
+  if (has_disasm) {
+    cs_insn *insn;
+    size_t count = cs_disasm_dl(handle, r->inst, r->ilen, r->pc, 0, &insn);
+    if (count == 1) {
+      int ret = snprintf(str, size, "%s", insn->mnemonic);
+      if (insn->op_str[0] != '\0') snprintf(str + ret, size - ret, "\t%s", insn->op_str);
+      cs_free_dl(insn, count);
+      return;
+    }
+  }
+#endif
+#ifdef HAS_RISCV32_DISASM
+  if (has_builtin && r->ilen == 4) {
+    riscv32_disassemble(str, size, r->pc, r->inst, r->ilen);
+    return;
+  }
+#endif
+  if (r->ilen == 4) {
+    uint32_t inst;
+    memcpy(&inst, r->inst, 4);
+    snprintf(str, size, ".word\t0x%08x", inst);
+  }
+}
+
+// ----------- main loop -----------
+
+// return the disassembly part of the line
+static char *format(char *str, int size, Record *r) {
+  char *p = str;
+  p += sprintf(p, "%10lu  0x%0*lx:", r->idx, word_size * 2, r->pc);
+  int i;
+  bool x86 = (strcmp(isa, "x86") == 0);
+  for (i = 0; i < r->ilen; i ++) {
+    p += sprintf(p, " %02x", r->inst[x86 ? i : r->ilen - 1 - i]);
+  }
+  int space_len = ((x86 ? 8 : 4) - r->ilen);
+  if (space_len < 0) space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+  char *disasm = p;
+  disassemble(p, str + size - p, r);
+  p += strlen(p);
+  if (r->rd != 0) {
+    snprintf(p, str + size - p, "\t# x%d <- 0x%0*lx", r->rd, word_size * 2, r->rd_val);
+  }
+  return disasm;
+}
+
+static void usage(const char *prog) {
+  printf("Usage: %s [OPTION...] TRACE\n\n", prog);
+  printf("\t-p,--pc=LO[-HI]         only show instructions with pc in [LO, HI]\n");
+  printf("\t-r,--range=FROM[-TO]    only show the FROM-th to TO-th executed instructions\n");
+  printf("\t-g,--grep=STR           only show instructions whose disassembly contains STR\n");
+  printf("\t-v,--value=VAL          only show instructions writing VAL to rd\n");
+  printf("\t-c,--count              only print the number of matched instructions\n");
+  printf("\t-l,--lib=PATH           path of libcapstone (default: $NEMU_HOME/tools/capstone/repo/libcapstone.so.5)\n");
+  printf("\t                        riscv32 traces fall back to the built-in disassembler\n");
+  printf("\n");
+  exit(0);
+}
+
+static void parse_range(const char *s, uint64_t *lo, uint64_t *hi) {
+  char *end;
+  *lo = strtoull(s, &end, 0);
+  *hi = (*end == '-' ? strtoull(end + 1, NULL, 0) : *lo);
+}
+
+int main(int argc, char *argv[]) {
+  char lib[512];
+  const char *nemu_home = getenv("NEMU_HOME");
+  snprintf(lib, sizeof(lib), "%s/tools/capstone/repo/libcapstone.so.5", nemu_home ? nemu_home : ".");
+
+  const struct option table[] = {
+    {"pc"   , required_argument, NULL, 'p'},
+    {"range", required_argument, NULL, 'r'},
+    {"grep" , required_argument, NULL, 'g'},
+    {"value", required_argument, NULL, 'v'},
+    {"count", no_argument      , NULL, 'c'},
+    {"lib"  , required_argument, NULL, 'l'},
+    {"help" , no_argument      , NULL, 'h'},
+    {0      , 0                , NULL,  0 },
+  };
+  int o;
+  while ( (o = getopt_long(argc, argv, "p:r:g:v:cl:h", table, NULL)) != -1) {
+    switch (o) {
+      case 'p': parse_range(optarg, &pc_lo, &pc_hi); break;
+      case 'r': parse_range(optarg, &idx_lo, &idx_hi); break;
+      case 'g': pattern = optarg; break;
+      case 'v': has_value = true; value = strtoull(optarg, NULL, 0); break;
+      case 'c': count_only = true; break;
+      case 'l': snprintf(lib, sizeof(lib), "%s", optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (argc - optind != 1) usage(argv[0]);
+
+  fp = fopen(argv[optind], "rb");
+  if (fp == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+  setvbuf(fp, NULL, _IOFBF, 1024 * 1024);
+  read_header();
+  if (has_value && !(flags & BINTRACE_FLAG_RD)) {
+    fprintf(stderr, "rd values are not recorded in this trace\n");
+    return 1;
+  }
+  // disassembly is only needed for printing and --grep
+  if (!count_only || pattern != NULL) init_disasm(lib);
+
+  Record r;
+  char line[512];
+  uint64_t nr_match = 0;
+  while (read_record(&r)) {
+    if (r.idx < idx_lo) continue;
+    if (r.idx > idx_hi) break;
+    if (r.pc < pc_lo || r.pc > pc_hi) continue;
+    if (has_value && (r.rd == 0 || r.rd_val != value)) continue;
+    if (pattern != NULL || !count_only) {
+      char *disasm = format(line, sizeof(line), &r);
+      if (pattern != NULL && strstr(disasm, pattern) == NULL) continue;
+    }
+    nr_match ++;
+    if (!count_only) puts(line);
+  }
+  if (count_only) printf("%lu\n", nr_match);
+  return 0;
+}
@@ -36,6 +36,20 @@
 #error Unsupport ISA
 #endif
 
+// the kind of software breakpoints, i.e. the size of the instruction
+#if defined(CONFIG_ISA_x86)
+#define ISA_BP_KIND 1
+#else
+#define ISA_BP_KIND 4
+#endif
+
+// whether isa_fallthrough() is implemented to batch instructions
+#if defined(CONFIG_ISA_riscv) && !defined(CONFIG_RV64)
+#define ISA_FALLTHROUGH 1
+#else
+#define ISA_FALLTHROUGH 0
+#endif
+
 union isa_gdb_regs {
   struct {
 #if defined(CONFIG_ISA_mips32)
@@ -18,6 +18,7 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 struct gdb_conn;
 
@@ -28,10 +29,29 @@ uint8_t hex_encode(uint8_t digit);
 
 struct gdb_conn *gdb_begin_inet(const char *addr, uint16_t port);
 
+struct gdb_conn *gdb_begin_unix(const char *path);
+
 void gdb_end(struct gdb_conn *conn);
 
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size);
 
+/* Queue a packet without flushing and without waiting for the ACK.
+ * Only valid in no-ack mode. Call gdb_flush() before receiving replies. */
+void gdb_send_nowait(struct gdb_conn *conn, const uint8_t *command, size_t size);
+
+void gdb_flush(struct gdb_conn *conn);
+
+/* Wait for a reply for at most `timeout_ms` milliseconds. Return whether
+ * it arrives. Only valid when no earlier reply is left unreceived. */
+bool gdb_poll(struct gdb_conn *conn, int timeout_ms);
+
+/* Interrupt the running target, which then sends a stop reply. */
+void gdb_interrupt(struct gdb_conn *conn);
+
+/* Escape binary data for the payload of an 'X' packet.
+ * `dst` should have room for 2 * n bytes. Return the escaped size. */
+size_t gdb_escape_binary(uint8_t *dst, const uint8_t *src, size_t n);
+
 uint8_t *gdb_recv(struct gdb_conn *conn, size_t *size);
 
 const char * gdb_start_noack(struct gdb_conn *conn);
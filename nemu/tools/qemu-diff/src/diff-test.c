@@ -18,21 +18,28 @@
 #include <sys/prctl.h>
 #include <signal.h>
 
-bool gdb_connect_qemu(int);
+bool gdb_connect_qemu(const char *);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_memcpy_from_qemu(void *, uint32_t, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
+bool gdb_setreg(int, uint32_t);
 bool gdb_si();
+bool gdb_run_to(uint32_t, int);
 void gdb_exit();
 
 void init_isa();
+uint32_t isa_pc();
+int isa_fallthrough(uint32_t, int, uint32_t *);
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(direction == DIFFTEST_TO_REF);
+  bool ok;
   if (direction == DIFFTEST_TO_REF) {
-    bool ok = gdb_memcpy_to_qemu(addr, buf, n);
-    assert(ok == 1);
+    ok = gdb_memcpy_to_qemu(addr, buf, n);
+  } else {
+    ok = gdb_memcpy_from_qemu(buf, addr, n);
   }
+  assert(ok == 1);
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
@@ -46,13 +53,57 @@ __EXPORT void difftest_regcpy(void *dut, bool direction) {
   }
 }
 
+// the layout of DUT registers follows the register numbers of GDB
+__EXPORT void difftest_regset(int idx, uint64_t val) {
+  assert(idx >= 0 && idx < DIFFTEST_REG_SIZE / sizeof(uint32_t));
+  gdb_setreg(idx, val);
+}
+
+// Checking a window of instructions costs a memory read (and a register
+// read if pc is unknown), so only check it when a batch may save more.
+#define MAX_BATCH 64
+#define MIN_BATCH 4
+
+// Run `n` instructions. Instructions which fall through to the next one
+// (see isa_fallthrough()) are run in one batch by a temporary breakpoint
+// right after them, and the one ending them (e.g. a branch) is stepped.
+// Note that QEMU takes interrupts while running to the breakpoint, which
+// it does not when stepping.
 __EXPORT void difftest_exec(uint64_t n) {
-  while (n --) gdb_si();
+#if ISA_FALLTHROUGH
+  bool pc_known = false;
+  uint32_t pc = 0;
+  while (n > MIN_BATCH) {
+    if (!pc_known) pc = isa_pc();
+    int k = isa_fallthrough(pc, n < MAX_BATCH ? n : MAX_BATCH, &pc);
+    if (k >= MIN_BATCH) {
+      bool ok = gdb_run_to(pc, ISA_BP_KIND);
+      if (!ok) {
+        printf("QEMU does not reach 0x%x after a batch of %d instructions, "
+            "probably due to an exception\n", pc, k);
+        assert(0);
+      }
+      n -= k;
+      pc_known = true;
+      continue;
+    }
+    // step the few fall-through instructions and the one ending them
+    for (k ++; k > 0; k --, n --) gdb_si();
+    pc_known = false;
+  }
+#endif
+  while (n > 0) {
+    gdb_si();
+    n --;
+  }
 }
 
 __EXPORT void difftest_init(int port) {
-  char buf[32];
-  sprintf(buf, "tcp::%d", port);
+  // talk to QEMU through a Unix domain socket, which has lower latency than TCP
+  char path[64], buf[128];
+  sprintf(path, "/tmp/nemu-qemu-diff-%d.sock", port);
+  sprintf(buf, "unix:%s,server=on,wait=off", path);
+  unlink(path);
 
   int ppid_before_fork = getpid();
   int pid = fork();
@@ -84,8 +135,9 @@ __EXPORT void difftest_init(int port) {
   else {
     // father
 
-    gdb_connect_qemu(port);
-    printf("Connect to QEMU with %s successfully\n", buf);
+    gdb_connect_qemu(path);
+    printf("Connect to QEMU with %s successfully\n", path);
+    unlink(path);
 
     atexit(gdb_exit);
 
@@ -13,56 +13,136 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+
 #include "common.h"
 
 static struct gdb_conn *conn;
 
-bool gdb_connect_qemu(int port) {
-  // connect to gdbserver on localhost port 1234
-  while ((conn = gdb_begin_inet("127.0.0.1", port)) == NULL) {
-    usleep(1);
-  }
+// In no-ack mode, commands whose replies are not needed immediately
+// (e.g. register and memory writes) are pipelined: their packets
+// are queued without waiting, and the replies are drained before the
+// reply of the next command which needs one is received.
+// Single steps are not pipelined, since QEMU drops the packets
+// received while the guest is running.
+static bool pipelined = false;
+static int nr_pending = 0;
+
+#define MAX_PIPELINE 256
+// payload per packet, keep the packet within the 4KB buffer of QEMU
+#define MEM_CHUNK 2000
+// see gdb_run_to()
+#define RUN_TO_TIMEOUT_MS 5000
+
+// "OK", or the stop reply (e.g. T05) of a step
+static bool reply_ok(const uint8_t *reply) {
+  return !strcmp((const char*)reply, "OK") || reply[0] == 'T' || reply[0] == 'S';
+}
 
-  return true;
+// return whether all drained replies are successful
+static bool drain_pending() {
+  bool ok = true;
+  size_t size;
+  gdb_flush(conn);
+  while (nr_pending > 0) {
+    uint8_t *reply = gdb_recv(conn, &size);
+    ok &= reply_ok(reply);
+    free(reply);
+    nr_pending --;
+  }
+  return ok;
 }
 
-static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
-  char *buf = malloc(len * 2 + 128);
-  assert(buf != NULL);
-  int p = sprintf(buf, "M0x%x,%x:", dest, len);
-  int i;
-  for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+static bool post(const uint8_t *cmd, size_t len) {
+  if (!pipelined) {
+    gdb_send(conn, cmd, len);
+    size_t size;
+    uint8_t *reply = gdb_recv(conn, &size);
+    bool ok = !strcmp((const char*)reply, "OK");
+    free(reply);
+    return ok;
   }
+  bool ok = true;
+  if (nr_pending >= MAX_PIPELINE) ok = drain_pending();
+  gdb_send_nowait(conn, cmd, len);
+  nr_pending ++;
+  return ok;
+}
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
-  free(buf);
+static uint8_t *request(const uint8_t *cmd, size_t len, size_t *size) {
+  if (!pipelined) {
+    gdb_send(conn, cmd, len);
+  } else {
+    gdb_send_nowait(conn, cmd, len);
+    drain_pending();
+  }
+  return gdb_recv(conn, size);
+}
 
+static bool request_ok(const uint8_t *cmd, size_t len) {
   size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
+  uint8_t *reply = request(cmd, len, &size);
   bool ok = !strcmp((const char*)reply, "OK");
   free(reply);
-
   return ok;
 }
 
+bool gdb_connect_qemu(const char *path) {
+  while ((conn = gdb_begin_unix(path)) == NULL) {
+    usleep(1);
+  }
+
+  pipelined = (strcmp(gdb_start_noack(conn), "OK") == 0);
+  return true;
+}
+
 bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
+  uint8_t *buf = malloc(MEM_CHUNK * 2 + 128);
+  assert(buf != NULL);
   bool ok = true;
-  while (len > mtu) {
-    ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
-    dest += mtu;
-    src += mtu;
-    len -= mtu;
+  // replies of earlier commands are not "OK"
+  if (pipelined) drain_pending();
+  while (len > 0) {
+    int n = (len > MEM_CHUNK ? MEM_CHUNK : len);
+    int p = sprintf((char *)buf, "X%x,%x:", dest, n);
+    p += gdb_escape_binary(buf + p, src, n);
+    ok &= post(buf, p);
+    dest += n;
+    src += n;
+    len -= n;
+  }
+  free(buf);
+
+  if (pipelined) ok &= drain_pending();
+  return ok;
+}
+
+bool gdb_memcpy_from_qemu(void *dest, uint32_t src, int len) {
+  char buf[64];
+  bool ok = true;
+  while (len > 0) {
+    int n = (len > MEM_CHUNK ? MEM_CHUNK : len);
+    int p = sprintf(buf, "m%x,%x", src, n);
+    size_t size;
+    uint8_t *reply = request((const uint8_t *)buf, p, &size);
+    if (size != n * 2) {
+      ok = false;
+    } else {
+      int i;
+      for (i = 0; i < n; i ++) {
+        ((uint8_t *)dest)[i] = gdb_decode_hex(reply[i * 2], reply[i * 2 + 1]);
+      }
+    }
+    free(reply);
+    dest += n;
+    src += n;
+    len -= n;
   }
-  ok &= gdb_memcpy_to_qemu_small(dest, src, len);
   return ok;
 }
 
 bool gdb_getregs(union isa_gdb_regs *r) {
-  gdb_send(conn, (const uint8_t *)"g", 1);
   size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
+  uint8_t *reply = request((const uint8_t *)"g", 1, &size);
 
   int i;
   uint8_t *p = reply;
@@ -93,26 +173,61 @@ bool gdb_setregs(union isa_gdb_regs *r) {
     p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  bool ok = request_ok((const uint8_t *)buf, p);
   free(buf);
+  return ok;
+}
+
+// set a single register with a P packet, which can be pipelined
+bool gdb_setreg(int idx, uint32_t val) {
+  char buf[32];
+  int p = sprintf(buf, "P%x=", idx);
+  int i;
+  for (i = 0; i < 4; i ++) {
+    uint8_t byte = val >> (i * 8); // target byte order
+    p += sprintf(buf + p, "%c%c", hex_encode(byte >> 4), hex_encode(byte & 0xf));
+  }
+  return post((const uint8_t *)buf, p);
+}
 
+// wait for the stop reply before sending the next packet
+bool gdb_si() {
+  char buf[] = "vCont;s:1";
   size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
+  uint8_t *reply = request((const uint8_t *)buf, strlen(buf), &size);
+  bool ok = reply_ok(reply);
   free(reply);
-
   return ok;
 }
 
-bool gdb_si() {
-  char buf[] = "vCont;s:1";
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+// Let QEMU run until it reaches `pc` by a temporary breakpoint. This is
+// much faster than single-stepping when a long way is to be caught up.
+// If QEMU does not reach `pc` in time (e.g. it traps), it is interrupted
+// and false is returned.
+bool gdb_run_to(uint32_t pc, int kind) {
+  char buf[64];
+  int p = sprintf(buf, "Z0,%x,%x", pc, kind);
+  bool ok = request_ok((const uint8_t *)buf, p);
+
+  // No other reply is pending now, so the stop reply can be polled.
+  // With acks, it may be buffered when the ack is read, so just wait.
+  const uint8_t cmd[] = "vCont;c:1";
+  gdb_send(conn, cmd, sizeof(cmd) - 1);
+  if (pipelined && !gdb_poll(conn, RUN_TO_TIMEOUT_MS)) {
+    gdb_interrupt(conn);
+    ok = false;
+  }
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
+  ok &= reply_ok(reply);
   free(reply);
-  return true;
+
+  // QEMU is stopped, so removing the breakpoint can be pipelined
+  p = sprintf(buf, "z0,%x,%x", pc, kind);
+  return post((const uint8_t *)buf, p) && ok;
 }
 
 void gdb_exit() {
+  drain_pending();
   gdb_end(conn);
 }
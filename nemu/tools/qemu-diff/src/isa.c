@@ -20,7 +20,7 @@
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
-void difftest_exec(uint64_t n);
+bool gdb_run_to(uint32_t pc, int kind);
 
 static uint8_t mbr[] = {
   // start16:
@@ -66,8 +66,58 @@ void init_isa() {
   ok = gdb_setregs(&r);
   assert(ok == 1);
 
-  // execute enough instructions to enter protected mode
-  difftest_exec(20);
+  // run until the dead loop at start32 after entering protected mode
+  ok = gdb_run_to(0x7c27, ISA_BP_KIND);
+  assert(ok == 1);
+}
+
+#elif defined(CONFIG_ISA_riscv) && !defined(CONFIG_RV64)
+
+bool gdb_memcpy_from_qemu(void *, uint32_t, int);
+bool gdb_getregs(union isa_gdb_regs *);
+
+void init_isa() {
+}
+
+// Whether `i` goes to the next instruction unless it faults. A faulting
+// load or store keeps QEMU from reaching the breakpoint after a batch,
+// which gdb_run_to() reports.
+static bool falls_through(uint32_t i) {
+  uint32_t funct3 = (i >> 12) & 0x7;
+  uint32_t funct7 = i >> 25;
+  switch (i & 0x7f) {
+    case 0x37: case 0x17: return true;        // lui, auipc
+    case 0x03: return funct3 != 3 && funct3 != 6 && funct3 != 7; // loads
+    case 0x23: return funct3 <= 2;            // stores
+    case 0x0f: return funct3 <= 1;            // fence, fence.i
+    case 0x13:                                // op-imm
+      if (funct3 == 1) return funct7 == 0x00; // slli
+      if (funct3 == 5) return funct7 == 0x00 || funct7 == 0x20; // srli, srai
+      return true;
+    case 0x33:                                // op, M extension included
+      return funct7 == 0x00 || funct7 == 0x01 ||
+        (funct7 == 0x20 && (funct3 == 0 || funct3 == 5)); // sub, sra
+    default: return false;
+  }
+}
+
+uint32_t isa_pc() {
+  union isa_gdb_regs r;
+  gdb_getregs(&r);
+  return r.pc;
+}
+
+// Return how many instructions (at most `n`) from `pc` fall through to
+// the next one, and the pc right after them in `end`.
+// A breakpoint at `end` is then hit exactly when all of them are executed.
+int isa_fallthrough(uint32_t pc, int n, uint32_t *end) {
+  uint32_t inst[n];
+  int k = 0;
+  if (gdb_memcpy_from_qemu(inst, pc, sizeof(inst))) {
+    for (; k < n && falls_through(inst[k]); k ++);
+  }
+  *end = pc + k * 4;
+  return k;
 }
 
 #else
@@ -26,8 +26,11 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
+#include <poll.h>
+
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 
 struct gdb_conn {
   FILE *in;
@@ -85,6 +88,10 @@ static struct gdb_conn* gdb_begin(int fd) {
   if (conn->out == NULL)
     err(1, "fdopen");
 
+  // large buffers so that pipelined packets go out in few writes
+  setvbuf(conn->in, NULL, _IOFBF, 65536);
+  setvbuf(conn->out, NULL, _IOFBF, 65536);
+
   // reset line state by acking any earlier input
   fputc('+', conn->out);
   fflush(conn->out);
@@ -129,13 +136,33 @@ struct gdb_conn* gdb_begin_inet(const char *addr, uint16_t port) {
 }
 
 
+struct gdb_conn* gdb_begin_unix(const char *path) {
+  struct sockaddr_un sa = {
+    .sun_family = AF_UNIX,
+  };
+  if (strlen(path) >= sizeof(sa.sun_path))
+    errx(1, "Socket path too long: %s", path);
+  strcpy(sa.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    err(1, "socket");
+  if (connect(fd, (const struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  return gdb_begin(fd);
+}
+
+
 void gdb_end(struct gdb_conn *conn) {
   fclose(conn->in);
   fclose(conn->out);
   free(conn);
 }
 
-static void send_packet(FILE *out, const uint8_t *command, size_t size) {
+static void send_packet(FILE *out, const uint8_t *command, size_t size, bool flush) {
   // compute the checksum -- simple mod256 addition
   uint8_t sum = 0;
   size_t i;
@@ -149,7 +176,8 @@ static void send_packet(FILE *out, const uint8_t *command, size_t size) {
   fputc('$', out); // packet start
   fwrite(command, 1, size, out); // payload
   fprintf(out, "#%02X", sum); // packet end, checksum
-  fflush(out);
+  if (flush)
+    fflush(out);
 
   if (ferror(out))
     err(1, "send");
@@ -160,7 +188,7 @@ static void send_packet(FILE *out, const uint8_t *command, size_t size) {
 void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   bool acked = false;
   do {
-    send_packet(conn->out, command, size);
+    send_packet(conn->out, command, size, true);
 
     if (!conn->ack)
       break;
@@ -170,6 +198,40 @@ void gdb_send(struct gdb_conn *conn, const uint8_t *command, size_t size) {
   } while (!acked);
 }
 
+void gdb_send_nowait(struct gdb_conn *conn, const uint8_t *command, size_t size) {
+  assert(!conn->ack);
+  send_packet(conn->out, command, size, false);
+}
+
+void gdb_flush(struct gdb_conn *conn) {
+  fflush(conn->out);
+  if (ferror(conn->out))
+    err(1, "send");
+}
+
+bool gdb_poll(struct gdb_conn *conn, int timeout_ms) {
+  struct pollfd pfd = { .fd = fileno(conn->in), .events = POLLIN };
+  return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+void gdb_interrupt(struct gdb_conn *conn) {
+  fputc(0x03, conn->out);
+  gdb_flush(conn);
+}
+
+size_t gdb_escape_binary(uint8_t *dst, const uint8_t *src, size_t n) {
+  size_t i, j = 0;
+  for (i = 0; i < n; i++) {
+    uint8_t c = src[i];
+    if (c == '$' || c == '#' || c == '}' || c == '*') {
+      dst[j++] = '}';
+      c ^= 0x20;
+    }
+    dst[j++] = c;
+  }
+  return j;
+}
+
 static uint8_t* recv_packet(FILE *in, size_t *ret_size, bool* ret_sum_ok) {
   size_t i = 0;
   size_t size = 4096;
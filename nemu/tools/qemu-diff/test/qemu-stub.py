@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+# A stand-in for qemu-system-riscv32 which speaks the GDB remote protocol
+# on the socket given by `-gdb unix:<path>,...`. It runs a small subset of
+# RV32IM, enough for test.py. An access outside the memory traps to
+# TRAP_VEC, which spins.
+#
+# Like QEMU, the bytes received while the guest is running (i.e. in the
+# same read as a vCont packet) are dropped, so a client pipelining packets
+# behind a step or a continue desyncs. The number of packets handled is
+# written to stderr on exit.
+
+import os, socket, sys
+
+MEM_BASE, MEM_SIZE = 0x80000000, 0x100000
+TRAP_VEC = MEM_BASE + MEM_SIZE - 4
+M32 = 0xffffffff
+
+def sext(v, bits):
+    return v - (1 << bits) if v & (1 << (bits - 1)) else v
+
+class Cpu:
+    def __init__(self):
+        self.gpr = [0] * 32
+        self.pc = MEM_BASE
+        self.mem = bytearray(MEM_SIZE)
+        self.store(TRAP_VEC, 0x6f, 4) # j .
+
+    def load(self, addr, n):
+        off = addr - MEM_BASE
+        if off < 0 or off + n > MEM_SIZE: raise IndexError
+        return int.from_bytes(self.mem[off:off + n], 'little')
+
+    def store(self, addr, val, n):
+        off = addr - MEM_BASE
+        if off < 0 or off + n > MEM_SIZE: raise IndexError
+        self.mem[off:off + n] = (val & ((1 << (8 * n)) - 1)).to_bytes(n, 'little')
+
+    def step(self):
+        i = self.load(self.pc, 4)
+        op, rd, f3 = i & 0x7f, (i >> 7) & 0x1f, (i >> 12) & 0x7
+        a, b, f7 = self.gpr[(i >> 15) & 0x1f], self.gpr[(i >> 20) & 0x1f], i >> 25
+        imm_i = sext(i >> 20, 12)
+        npc, val = self.pc + 4, None
+        if op == 0x37:
+            val = i & 0xfffff000
+        elif op == 0x17:
+            val = self.pc + (i & 0xfffff000)
+        elif op == 0x13:
+            sh = imm_i & 0x1f
+            val = {0: a + imm_i, 1: a << sh, 2: int(sext(a, 32) < imm_i),
+                   3: int(a < (imm_i & M32)), 4: a ^ imm_i,
+                   5: (sext(a, 32) >> sh) if f7 == 0x20 else (a >> sh),
+                   6: a | imm_i, 7: a & imm_i}[f3]
+        elif op == 0x33 and f7 == 0x01:
+            val = {0: a * b, 4: (a // b) if b else M32, 6: (a % b) if b else a}[f3]
+        elif op == 0x33:
+            val = {0: (a - b) if f7 == 0x20 else (a + b), 1: a << (b & 0x1f),
+                   2: int(sext(a, 32) < sext(b, 32)), 3: int(a < b), 4: a ^ b,
+                   5: (sext(a, 32) >> (b & 0x1f)) if f7 == 0x20 else (a >> (b & 0x1f)),
+                   6: a | b, 7: a & b}[f3]
+        elif op in (0x03, 0x23):
+            try:
+                if op == 0x03: val = self.load((a + imm_i) & M32, 4)
+                else: self.store((a + sext((f7 << 5) | rd, 12)) & M32, b, 4)
+            except IndexError:
+                self.pc = TRAP_VEC
+                return
+        elif op == 0x63:
+            off = sext(((i >> 31) << 12) | (((i >> 7) & 1) << 11) |
+                       (((i >> 25) & 0x3f) << 5) | (((i >> 8) & 0xf) << 1), 13)
+            taken = {0: a == b, 1: a != b, 4: sext(a, 32) < sext(b, 32),
+                     5: sext(a, 32) >= sext(b, 32), 6: a < b, 7: a >= b}[f3]
+            if taken: npc = self.pc + off
+        elif op == 0x6f:
+            off = sext(((i >> 31) << 20) | (((i >> 12) & 0xff) << 12) |
+                       (((i >> 20) & 1) << 11) | (((i >> 21) & 0x3ff) << 1), 21)
+            val, npc = self.pc + 4, self.pc + off
+        elif op == 0x67:
+            val, npc = self.pc + 4, (a + imm_i) & ~1
+        elif op != 0x0f:
+            raise RuntimeError('unsupported instruction %08x at %08x' % (i, self.pc))
+        if val is not None and rd != 0: self.gpr[rd] = val & M32
+        self.pc = npc & M32
+
+    def regs(self):
+        return b''.join(r.to_bytes(4, 'little') for r in self.gpr + [self.pc])
+
+def unescape(data):
+    out, i = bytearray(), 0
+    while i < len(data):
+        if data[i] == ord('}'):
+            out.append(data[i + 1] ^ 0x20); i += 2
+        else:
+            out.append(data[i]); i += 1
+    return bytes(out)
+
+class Stub:
+    def __init__(self, conn):
+        self.conn, self.buf, self.ack = conn, b'', True
+        self.cpu, self.bps, self.nr_packet = Cpu(), set(), 0
+
+    def send(self, payload):
+        self.conn.sendall(b'$%s#%02x' % (payload, sum(payload) & 0xff))
+
+    def packets(self):
+        while True:
+            while self.buf[:1] in (b'+', b'-'): self.buf = self.buf[1:]
+            end = self.buf.find(b'#')
+            if self.buf[:1] != b'$' or end < 0 or len(self.buf) < end + 3:
+                data = self.conn.recv(65536)
+                if not data: return
+                self.buf += data
+                continue
+            payload, self.buf = self.buf[1:end], self.buf[end + 3:]
+            if self.ack: self.conn.sendall(b'+')
+            self.nr_packet += 1
+            yield payload
+
+    def run(self, step):
+        # QEMU drops what has been received while the guest runs,
+        # except ^C, which stops the guest
+        self.buf = b''
+        nr_inst = 0
+        while True:
+            self.cpu.step()
+            if step or self.cpu.pc in self.bps: break
+            nr_inst += 1
+            if nr_inst % 4096 == 0:
+                try:
+                    if b'\x03' in self.conn.recv(65536, socket.MSG_DONTWAIT):
+                        self.send(b'T02thread:01;')
+                        return
+                except BlockingIOError:
+                    pass
+        self.send(b'T05thread:01;')
+
+    def serve(self):
+        cpu = self.cpu
+        for p in self.packets():
+            if p == b'QStartNoAckMode':
+                self.send(b'OK'); self.ack = False
+            elif p == b'?':
+                self.send(b'S05')
+            elif p == b'g':
+                self.send(cpu.regs().hex().encode())
+            elif p[:1] == b'G':
+                r = bytes.fromhex(p[1:].decode())
+                v = [int.from_bytes(r[i:i + 4], 'little') for i in range(0, 132, 4)]
+                cpu.gpr, cpu.pc = [0] + v[1:32], v[32]
+                self.send(b'OK')
+            elif p[:1] == b'P':
+                idx, val = p[1:].split(b'=')
+                v = int.from_bytes(bytes.fromhex(val.decode()), 'little')
+                if int(idx, 16) == 32: cpu.pc = v
+                elif int(idx, 16) != 0: cpu.gpr[int(idx, 16)] = v
+                self.send(b'OK')
+            elif p[:1] == b'm':
+                addr, n = (int(x, 16) for x in p[1:].split(b','))
+                off = addr - MEM_BASE
+                self.send(cpu.mem[off:off + n].hex().encode())
+            elif p[:1] == b'X':
+                hdr, data = p[1:].split(b':', 1)
+                addr, n = (int(x, 16) for x in hdr.split(b','))
+                data = unescape(data)
+                assert len(data) == n
+                off = addr - MEM_BASE
+                cpu.mem[off:off + n] = data
+                self.send(b'OK')
+            elif p[:3] in (b'Z0,', b'z0,'):
+                addr = int(p[3:].split(b',')[0], 16)
+                if p[:1] == b'Z': self.bps.add(addr)
+                else: self.bps.discard(addr)
+                self.send(b'OK')
+            elif p.startswith(b'vCont;'):
+                self.run(p[6:7] == b's')
+            else:
+                self.send(b'')
+
+def main():
+    spec = sys.argv[sys.argv.index('-gdb') + 1]
+    path = spec[len('unix:'):].split(',')[0]
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.bind(path)
+    s.listen(1)
+    conn, _ = s.accept()
+    stub = Stub(conn)
+    try:
+        stub.serve()
+    finally:
+        sys.stderr.write('stub: %d packets\n' % stub.nr_packet)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+# Check the riscv32 qemu-diff REF against qemu-stub.py, which stands in for
+# QEMU. Build the REF first with `make GUEST_ISA=riscv`, then run
+#   python3 test/test.py [build/riscv-qemu-so]
+# Memory is written and read back through X/m packets, and the REF is run
+# in batches of various sizes and compared with the stub's own CPU model
+# stepped one instruction at a time. At last, a batch with a faulting load
+# should be reported instead of hanging.
+
+import ctypes, importlib.util, os, random, sys, tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+spec = importlib.util.spec_from_file_location('stub', os.path.join(HERE, 'qemu-stub.py'))
+stub = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(stub)
+
+TO_DUT, TO_REF = 0, 1
+NR_REG = 33
+
+def r(f7, rs2, rs1, f3, rd, op): return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op
+def i(imm, rs1, f3, rd, op): return ((imm & 0xfff) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op
+def s(imm, rs2, rs1): return r((imm >> 5) & 0x7f, rs2, rs1, 2, imm & 0x1f, 0x23)
+def b(off, rs2, rs1, f3):
+    off &= 0x1fff
+    return ((off >> 12) << 31) | (((off >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) | \
+        (f3 << 12) | (((off >> 1) & 0xf) << 8) | (((off >> 11) & 1) << 7) | 0x63
+
+# a loop of fall-through instructions ended by loads, stores and a branch
+prog = [
+    0x800102b7,              # lui   t0, 0x80010
+    i(0, 0, 0, 6, 0x13),     # li    t1, 0
+    i(300, 0, 0, 7, 0x13),   # li    t2, 300
+    i(3, 6, 0, 10, 0x13),    # loop: addi a0, t1, 3
+    i(2, 10, 1, 11, 0x13),   # slli  a1, a0, 2
+    r(0, 6, 11, 4, 12, 0x33),      # xor   a2, a1, t1
+    r(0, 10, 12, 0, 13, 0x33),     # add   a3, a2, a0
+    r(1, 13, 13, 0, 14, 0x33),     # mul   a4, a3, a3
+    r(0x20, 6, 14, 0, 15, 0x33),   # sub   a5, a4, t1
+    i(0x403, 15, 5, 16, 0x13),     # srai  a6, a5, 3
+    s(0, 16, 5),             # sw    a6, 0(t0)
+    i(0, 5, 2, 17, 0x03),    # lw    a7, 0(t0)
+    i(4, 5, 0, 5, 0x13),     # addi  t0, t0, 4
+    i(1, 6, 0, 6, 0x13),     # addi  t1, t1, 1
+    b(-44, 7, 6, 4),         # blt   t1, t2, loop
+    0x0000006f,              # j     .
+]
+
+def main():
+    so = sys.argv[1] if len(sys.argv) > 1 else os.path.join(HERE, '../build/riscv-qemu-so')
+    ref = ctypes.CDLL(os.path.abspath(so))
+
+    # let difftest_init() start the stub instead of QEMU
+    bindir = tempfile.mkdtemp()
+    os.symlink(os.path.join(HERE, 'qemu-stub.py'), os.path.join(bindir, 'qemu-system-riscv32'))
+    os.environ['PATH'] = bindir + ':' + os.environ['PATH']
+    ref.difftest_init(os.getpid() % 10000)
+
+    # all byte values, including the ones escaped in X packets
+    data = bytes(random.randrange(256) for _ in range(10000)) + b'$#}*' * 16
+    ref.difftest_memcpy(0x80040000, data, len(data), TO_REF)
+    back = ctypes.create_string_buffer(len(data))
+    ref.difftest_memcpy(0x80040000, back, len(data), TO_DUT)
+    assert back.raw == data, 'X/m round trip'
+
+    code = b''.join(x.to_bytes(4, 'little') for x in prog)
+    ref.difftest_memcpy(0x80000000, code, len(code), TO_REF)
+    cpu = stub.Cpu()
+    cpu.mem[0:len(code)] = code
+    regs = (ctypes.c_uint32 * NR_REG)(*([0] * 32 + [0x80000000]))
+    ref.difftest_regcpy(regs, TO_REF)
+
+    nr_inst = 0
+    while nr_inst < 4000:
+        n = random.choice([1, 2, 5, 13, 64, 300])
+        ref.difftest_exec(ctypes.c_uint64(n))
+        for _ in range(n): cpu.step()
+        nr_inst += n
+        ref.difftest_regcpy(regs, TO_DUT)
+        assert list(regs) == cpu.gpr + [cpu.pc], 'mismatch after %d instructions' % nr_inst
+
+    # lw a0, 0x10(zero) faults in the middle of a batch
+    fault = [i(0x10, 0, 2, 10, 0x03)] + [i(1, 10, 0, 10, 0x13)] * 8 + [0x0000006f]
+    code = b''.join(x.to_bytes(4, 'little') for x in fault)
+    ref.difftest_memcpy(0x80020000, code, len(code), TO_REF)
+    regs[32] = 0x80020000
+    ref.difftest_regcpy(regs, TO_REF)
+    pid = os.fork()
+    if pid == 0:
+        ref.difftest_exec(ctypes.c_uint64(9))
+        os._exit(0)
+    _, status = os.waitpid(pid, 0)
+    assert os.WIFSIGNALED(status), 'a faulting batch is not reported'
+    print('PASS: %d instructions' % nr_inst)
+
+if __name__ == '__main__':
+    main()
@@ -83,10 +83,22 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    // spike allocates memory by pages, so copy page by page
+    while (n > 0) {
+      size_t len = std::min(n, (size_t)(PGSIZE - (addr % PGSIZE)));
+      memcpy(buf, s->addr_to_mem(addr), len);
+      addr += len;
+      buf = (uint8_t *)buf + len;
+      n -= len;
+    }
   }
 }
 
+__EXPORT uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  assert(addr % PGSIZE == 0 && n <= PGSIZE);
+  return difftest_hash(s->addr_to_mem(addr), n);
+}
+
 __EXPORT void difftest_regcpy(void* dut, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     s->diff_set_regs(dut);
@@ -95,6 +107,16 @@ __EXPORT void difftest_regcpy(void* dut, bool direction) {
   }
 }
 
+// set the `idx`-th register in the layout of diff_context_t
+__EXPORT void difftest_regset(int idx, uint64_t val) {
+  if (idx < NR_GPR) {
+    state->XPR.write(idx, (sword_t)val);
+  } else {
+    assert(idx == NR_GPR);
+    state->pc = val;
+  }
+}
+
 __EXPORT void difftest_exec(uint64_t n) {
   s->diff_step(n);
 }